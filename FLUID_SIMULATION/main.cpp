@@ -4,6 +4,122 @@
 #include <iomanip>
 #include <time.h>
 #include <functional>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Build with -DTRACK_ALLOCATIONS to count heap allocations: --check then verifies that warmed
+// up frames allocate nothing, and the window logs simulation frames that do allocate
+#ifdef TRACK_ALLOCATIONS
+std::atomic<long long> allocationCount(0);
+
+// Kept out of line: GCC flags free() on memory from operator new once a delete is inlined
+#if defined(__GNUC__) || defined(__clang__)
+#define REPLACED_ALLOCATION __attribute__((noinline))
+#else
+#define REPLACED_ALLOCATION
+#endif
+
+REPLACED_ALLOCATION void* operator new(size_t size) {
+    allocationCount++;
+    if (void* memory = malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+REPLACED_ALLOCATION void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+REPLACED_ALLOCATION void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+REPLACED_ALLOCATION void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+REPLACED_ALLOCATION void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+REPLACED_ALLOCATION void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+#ifdef __cpp_aligned_new
+// Over-aligned types, which Windows has to free with _aligned_free
+REPLACED_ALLOCATION void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount++;
+    const size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+    void* memory = nullptr;
+#ifdef _WIN32
+    memory = _aligned_malloc(size ? size : 1, align);
+#else
+    if (posix_memalign(&memory, align, size ? size : 1) != 0) memory = nullptr;
+#endif
+    if (memory) return memory;
+    throw std::bad_alloc();
+}
+
+REPLACED_ALLOCATION void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+REPLACED_ALLOCATION void operator delete(void* memory, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+REPLACED_ALLOCATION void operator delete[](void* memory, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+REPLACED_ALLOCATION void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+REPLACED_ALLOCATION void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+#endif
+#endif
+
+// Heap allocations so far, -1 without TRACK_ALLOCATIONS
+long long getAllocationCount() {
+#ifdef TRACK_ALLOCATIONS
+    return allocationCount;
+#else
+    return -1;
+#endif
+}
 
 bool show_menu = true;
 bool show_coloring = true;
@@ -89,377 +205,5716 @@ public:
     int getValue() const {
         return currentValue;
     }
-};
+};
+
+class Button {
+private:
+    sf::RectangleShape shape;
+    sf::Text text;
+    sf::Font font;
+    bool enabled = true;
+    std::function<void()> callback;
+public:
+    Button(float x, float y, float width, float height, const std::string& label, const sf::Font& font) {
+        shape.setPosition(x, y);
+        shape.setSize(sf::Vector2f(width, height));
+        shape.setFillColor(sf::Color::Blue);
+        shape.setOutlineColor(sf::Color::Black);
+        shape.setOutlineThickness(2);
+
+        this->font = font;
+        text.setFont(this->font);
+        text.setString(label);
+        text.setCharacterSize(20);
+        text.setFillColor(sf::Color::White);
+
+        // Center text
+        sf::FloatRect textBounds = text.getLocalBounds();
+        text.setOrigin(textBounds.left + textBounds.width / 2.0f, textBounds.top + textBounds.height / 2.0f);
+        text.setPosition(x + width / 2.0f, y + height / 2.0f);
+    }
+
+    void setCallback(const std::function<void()>& func) {
+        callback = func;
+    }
+
+    void setEnabled(bool value) {
+        enabled = value;
+    }
+
+    void draw(sf::RenderWindow& window) {
+        window.draw(shape);
+        window.draw(text);
+    }
+
+    void handleEvent(const sf::Event& event, const sf::RenderWindow& window) {
+        if (enabled && event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
+            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
+            if (shape.getGlobalBounds().contains(static_cast<sf::Vector2f>(mousePos))) {
+                if (callback) callback(); // Run the given function
+            }
+        }
+    }
+};
+
+
+// Simulation state only, the circles are generated from it in FluidSimulator::draw()
+struct Particle {
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    sf::Vector2f force;
+    float density = 0.f;
+    float pressure = 0.f;
+};
+
+// Buffers of at least one huge page are placed on 2 MB boundaries and advised to use
+// transparent huge pages on Linux, so the neighbor passes over millions of particles
+// take fewer TLB misses. Without THP the advice fails and the buffer keeps normal pages.
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+std::atomic<bool> useHugePages(true);
+
+// std::vector allocator that starts every buffer on an ALIGNMENT byte boundary, large ones
+// on huge pages where available
+template <typename T, size_t ALIGNMENT = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&) {}
+
+    T* allocate(size_t count) {
+        void* memory = nullptr;
+#ifdef TRACK_ALLOCATIONS
+        allocationCount++;
+#endif
+#ifdef __linux__
+        const size_t bytes = count * sizeof(T);
+        if (useHugePages && bytes >= HUGE_PAGE_SIZE) {
+            const size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            if (posix_memalign(&memory, HUGE_PAGE_SIZE, rounded) == 0) {
+                madvise(memory, rounded, MADV_HUGEPAGE);
+                return static_cast<T*>(memory);
+            }
+            memory = nullptr;
+        }
+#endif
+#ifdef _WIN32
+        memory = _aligned_malloc(count * sizeof(T), ALIGNMENT);
+#else
+        if (posix_memalign(&memory, ALIGNMENT, count * sizeof(T)) != 0) memory = nullptr;
+#endif
+        if (!memory) throw std::bad_alloc();
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T* memory, size_t) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, ALIGNMENT>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, ALIGNMENT>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+typedef std::vector<int, AlignedAllocator<int>> AlignedInts;
+
+// Whole-particle and vector helpers shared by the particle stores, built on the per-attribute
+// accessors x(i) ... pressure(i) that each layout provides
+template <typename Store>
+class ParticleAccessors {
+private:
+    Store& self() { return static_cast<Store&>(*this); }
+    const Store& self() const { return static_cast<const Store&>(*this); }
+public:
+    bool empty() const { return self().size() == 0; }
+
+    void push_back(const Particle& p) {
+        const size_t i = self().size();
+        self().resize(i + 1);
+        set(i, p);
+    }
+
+    Particle get(size_t i) const {
+        Particle p;
+        p.position = position(i);
+        p.velocity = velocity(i);
+        p.force = force(i);
+        p.density = self().density(i);
+        p.pressure = self().pressure(i);
+        return p;
+    }
+
+    void set(size_t i, const Particle& p) {
+        setPosition(i, p.position);
+        setVelocity(i, p.velocity);
+        setForce(i, p.force);
+        self().density(i) = p.density;
+        self().pressure(i) = p.pressure;
+    }
+
+    // Slot k receives particle order[k] of source
+    void gather(const Store& source, const int* order, size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            set(k, source.get(order[k]));
+        }
+    }
+
+    sf::Vector2f position(size_t i) const { return sf::Vector2f(self().x(i), self().y(i)); }
+    sf::Vector2f velocity(size_t i) const { return sf::Vector2f(self().vx(i), self().vy(i)); }
+    sf::Vector2f force(size_t i) const { return sf::Vector2f(self().fx(i), self().fy(i)); }
+
+    void setPosition(size_t i, const sf::Vector2f& v) { self().x(i) = v.x; self().y(i) = v.y; }
+    void setVelocity(size_t i, const sf::Vector2f& v) { self().vx(i) = v.x; self().vy(i) = v.y; }
+    void setForce(size_t i, const sf::Vector2f& v) { self().fx(i) = v.x; self().fy(i) = v.y; }
+    void addVelocity(size_t i, const sf::Vector2f& v) { self().vx(i) += v.x; self().vy(i) += v.y; }
+    void addForce(size_t i, const sf::Vector2f& v) { self().fx(i) += v.x; self().fy(i) += v.y; }
+    void movePosition(size_t i, const sf::Vector2f& v) { self().x(i) += v.x; self().y(i) += v.y; }
+};
+
+// Array of Particle structs, all attributes of a particle share a cache line
+class AoSParticleStore : public ParticleAccessors<AoSParticleStore> {
+private:
+    std::vector<Particle, AlignedAllocator<Particle>> items;
+public:
+    size_t size() const { return items.size(); }
+    void resize(size_t count) { items.resize(count); }
+    void reserve(size_t count) { items.reserve(count); }
+    void clear() { items.clear(); }
+    void swap(AoSParticleStore& other) { items.swap(other.items); }
+
+    float& x(size_t i) { return items[i].position.x; }
+    float& y(size_t i) { return items[i].position.y; }
+    float& vx(size_t i) { return items[i].velocity.x; }
+    float& vy(size_t i) { return items[i].velocity.y; }
+    float& fx(size_t i) { return items[i].force.x; }
+    float& fy(size_t i) { return items[i].force.y; }
+    float& density(size_t i) { return items[i].density; }
+    float& pressure(size_t i) { return items[i].pressure; }
+    float x(size_t i) const { return items[i].position.x; }
+    float y(size_t i) const { return items[i].position.y; }
+    float vx(size_t i) const { return items[i].velocity.x; }
+    float vy(size_t i) const { return items[i].velocity.y; }
+    float fx(size_t i) const { return items[i].force.x; }
+    float fy(size_t i) const { return items[i].force.y; }
+    float density(size_t i) const { return items[i].density; }
+    float pressure(size_t i) const { return items[i].pressure; }
+};
+
+// Particles as one cache line aligned array per attribute, so a pass streams only the
+// attributes it touches
+class SoAParticleStore : public ParticleAccessors<SoAParticleStore> {
+private:
+    AlignedFloats xs, ys;
+    AlignedFloats vxs, vys;
+    AlignedFloats fxs, fys;
+    AlignedFloats densities;
+    AlignedFloats pressures;
+
+    template <typename Fn>
+    void forEachArray(Fn fn) {
+        for (AlignedFloats* array : {&xs, &ys, &vxs, &vys, &fxs, &fys, &densities, &pressures}) {
+            fn(*array);
+        }
+    }
+public:
+    size_t size() const { return xs.size(); }
+    void resize(size_t count) { forEachArray([&](AlignedFloats& array) { array.resize(count, 0.f); }); }
+    void reserve(size_t count) { forEachArray([&](AlignedFloats& array) { array.reserve(count); }); }
+    void clear() { forEachArray([](AlignedFloats& array) { array.clear(); }); }
+
+    void swap(SoAParticleStore& other) {
+        xs.swap(other.xs);
+        ys.swap(other.ys);
+        vxs.swap(other.vxs);
+        vys.swap(other.vys);
+        fxs.swap(other.fxs);
+        fys.swap(other.fys);
+        densities.swap(other.densities);
+        pressures.swap(other.pressures);
+    }
+
+    // One attribute array at a time
+    void gather(const SoAParticleStore& source, const int* order, size_t begin, size_t end) {
+        auto gatherArray = [&](AlignedFloats& to, const AlignedFloats& from) {
+            for (size_t k = begin; k < end; k++) {
+                to[k] = from[order[k]];
+            }
+        };
+        gatherArray(xs, source.xs);
+        gatherArray(ys, source.ys);
+        gatherArray(vxs, source.vxs);
+        gatherArray(vys, source.vys);
+        gatherArray(fxs, source.fxs);
+        gatherArray(fys, source.fys);
+        gatherArray(densities, source.densities);
+        gatherArray(pressures, source.pressures);
+    }
+
+    float& x(size_t i) { return xs[i]; }
+    float& y(size_t i) { return ys[i]; }
+    float& vx(size_t i) { return vxs[i]; }
+    float& vy(size_t i) { return vys[i]; }
+    float& fx(size_t i) { return fxs[i]; }
+    float& fy(size_t i) { return fys[i]; }
+    float& density(size_t i) { return densities[i]; }
+    float& pressure(size_t i) { return pressures[i]; }
+    float x(size_t i) const { return xs[i]; }
+    float y(size_t i) const { return ys[i]; }
+    float vx(size_t i) const { return vxs[i]; }
+    float vy(size_t i) const { return vys[i]; }
+    float fx(size_t i) const { return fxs[i]; }
+    float fy(size_t i) const { return fys[i]; }
+    float density(size_t i) const { return densities[i]; }
+    float pressure(size_t i) const { return pressures[i]; }
+
+    float* xData() { return xs.data(); }
+    float* yData() { return ys.data(); }
+    float* vxData() { return vxs.data(); }
+    float* vyData() { return vys.data(); }
+    const float* fxData() const { return fxs.data(); }
+    const float* fyData() const { return fys.data(); }
+    const float* densityData() const { return densities.data(); }
+};
+
+// Floats per SIMD register, the block width of AoSoAParticleStore
+#if defined(__AVX__)
+const int SIMD_LANES = 8;
+#else
+const int SIMD_LANES = 4;
+#endif
+
+// Blocks of LANES particles with one short array per attribute. A vector load reads one
+// attribute of a whole block, and a single neighbor's attributes stay within 8 * LANES floats.
+template <int LANES>
+class AoSoAParticleStore : public ParticleAccessors<AoSoAParticleStore<LANES>> {
+private:
+    static_assert((LANES & (LANES - 1)) == 0, "LANES must be a power of two");
+
+    struct Block {
+        float x[LANES], y[LANES];
+        float vx[LANES], vy[LANES];
+        float fx[LANES], fy[LANES];
+        float density[LANES];
+        float pressure[LANES];
+    };
+
+    std::vector<Block, AlignedAllocator<Block>> blocks;
+    size_t count = 0;
+
+    Block& block(size_t i) { return blocks[i / LANES]; }
+    const Block& block(size_t i) const { return blocks[i / LANES]; }
+public:
+    size_t size() const { return count; }
+
+    // Lanes past the last particle are kept zeroed
+    void resize(size_t newCount) {
+        for (size_t i = newCount; i < std::min(count, blocks.size() * LANES); i++) {
+            this->set(i, Particle());
+        }
+        blocks.resize((newCount + LANES - 1) / LANES, Block());
+        count = newCount;
+    }
+    void reserve(size_t capacity) { blocks.reserve((capacity + LANES - 1) / LANES); }
+    void clear() { blocks.clear(); count = 0; }
+
+    void swap(AoSoAParticleStore& other) {
+        blocks.swap(other.blocks);
+        std::swap(count, other.count);
+    }
+
+    float& x(size_t i) { return block(i).x[i % LANES]; }
+    float& y(size_t i) { return block(i).y[i % LANES]; }
+    float& vx(size_t i) { return block(i).vx[i % LANES]; }
+    float& vy(size_t i) { return block(i).vy[i % LANES]; }
+    float& fx(size_t i) { return block(i).fx[i % LANES]; }
+    float& fy(size_t i) { return block(i).fy[i % LANES]; }
+    float& density(size_t i) { return block(i).density[i % LANES]; }
+    float& pressure(size_t i) { return block(i).pressure[i % LANES]; }
+    float x(size_t i) const { return block(i).x[i % LANES]; }
+    float y(size_t i) const { return block(i).y[i % LANES]; }
+    float vx(size_t i) const { return block(i).vx[i % LANES]; }
+    float vy(size_t i) const { return block(i).vy[i % LANES]; }
+    float fx(size_t i) const { return block(i).fx[i % LANES]; }
+    float fy(size_t i) const { return block(i).fy[i % LANES]; }
+    float density(size_t i) const { return block(i).density[i % LANES]; }
+    float pressure(size_t i) const { return block(i).pressure[i % LANES]; }
+};
+
+// IEEE binary16, round to nearest even with subnormals, infinities and NaN. Builds with F16C
+// enabled convert in one instruction; otherwise float arithmetic does the rounding and
+// rescaling, so the common cases take no data dependent branches.
+inline std::uint16_t floatToHalf(float value) {
+#ifdef __F16C__
+    return static_cast<std::uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+    // 65536 and above is infinity, NaN stays quiet. 65520 up to there rounds into infinity below.
+    if (magnitude >= 0x47800000u) {
+        return static_cast<std::uint16_t>(sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x200u : 0u));
+    }
+    // Below 2^-14 the result is subnormal: adding 0.5 shifts the value into the low mantissa
+    // bits of the sum, where the addition itself rounds it to units of 2^-24
+    if (magnitude < 0x38800000u) {
+        const std::uint32_t SUBNORMAL_MAGIC = 0x3F000000u;
+        float scaled, magic;
+        std::memcpy(&scaled, &magnitude, sizeof(scaled));
+        std::memcpy(&magic, &SUBNORMAL_MAGIC, sizeof(magic));
+        scaled += magic;
+        std::memcpy(&magnitude, &scaled, sizeof(magnitude));
+        return static_cast<std::uint16_t>(sign | (magnitude - SUBNORMAL_MAGIC));
+    }
+    // Rebias the exponent from 127 to 15 and round to nearest even, a mantissa carry moves
+    // into the exponent
+    const std::uint32_t odd = (magnitude >> 13) & 1u;
+    magnitude += 0xC8000FFFu + odd;
+    return static_cast<std::uint16_t>(sign | (magnitude >> 13));
+#endif
+}
+
+inline float halfToFloat(std::uint16_t half) {
+#ifdef __F16C__
+    return _cvtsh_ss(half);
+#else
+    // Exponent and mantissa shifted into place are the value times 2^-112, subnormals included.
+    // Infinities and NaN keep the top exponent.
+    std::uint32_t bits = static_cast<std::uint32_t>(half & 0x7FFFu) << 13;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    value *= 5.192296858534828e33f;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits |= (half & 0x7C00u) == 0x7C00u ? 0x7F800000u : 0u;
+    bits |= static_cast<std::uint32_t>(half & 0x8000u) << 16;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+// Fixed point positions: the upper 16 bits are the index of a POSITION_CELL pixel cell, the
+// lower 16 bits the offset inside it, so one step is 1/4096 px over +-524288 px
+const float POSITION_CELL = 16.f;
+const float FIXED_POSITION_SCALE = 65536.f / POSITION_CELL;
+
+// Saturates outside the range, NaN becomes 0
+inline std::int32_t floatToFixed(float value) {
+    const float scaled = value * FIXED_POSITION_SCALE;
+    if (scaled != scaled) return 0;
+    if (scaled <= -2147483648.f) return INT32_MIN;
+    if (scaled >= 2147483648.f) return INT32_MAX;
+    return static_cast<std::int32_t>(std::lrintf(scaled));
+}
+
+inline float fixedToFloat(std::int32_t fixed) {
+    return static_cast<float>(fixed) * (1.f / FIXED_POSITION_SCALE);
+}
+
+// Pressure exceeds the half range (65504) in compressed fluid, so it is stored divided by a
+// power of two, which costs no extra rounding
+const float PRESSURE_HALF_SCALE = 1024.f;
+
+inline std::uint16_t pressureToHalf(float pressure) { return floatToHalf(pressure * (1.f / PRESSURE_HALF_SCALE)); }
+inline float halfToPressure(std::uint16_t half) { return halfToFloat(half) * PRESSURE_HALF_SCALE; }
+
+// Reference to a packed attribute that reads and writes like a float&
+template <typename Bits, float (*DECODE)(Bits), Bits (*ENCODE)(float)>
+class PackedFloatRef {
+private:
+    Bits& bits;
+public:
+    explicit PackedFloatRef(Bits& bits) : bits(bits) {}
+
+    operator float() const { return DECODE(bits); }
+
+    PackedFloatRef& operator=(float value) { bits = ENCODE(value); return *this; }
+    PackedFloatRef& operator=(const PackedFloatRef& other) { bits = other.bits; return *this; }
+    PackedFloatRef& operator+=(float value) { bits = ENCODE(DECODE(bits) + value); return *this; }
+    PackedFloatRef& operator-=(float value) { bits = ENCODE(DECODE(bits) - value); return *this; }
+    PackedFloatRef& operator*=(float value) { bits = ENCODE(DECODE(bits) * value); return *this; }
+};
+
+typedef PackedFloatRef<std::int32_t, fixedToFloat, floatToFixed> FixedPositionRef;
+typedef PackedFloatRef<std::uint16_t, halfToFloat, floatToHalf> HalfRef;
+typedef PackedFloatRef<std::uint16_t, halfToPressure, pressureToHalf> HalfPressureRef;
+
+// Mixed precision structure of arrays: fixed point positions, half velocity, density and
+// pressure, float forces since they accumulate over many neighbors. Kernels convert to float
+// in registers, 24 instead of 32 bytes per particle. It saves memory, not time: on scenes
+// that fit the caches a step takes 25 to 50% longer than with SoAParticleStore (see
+// benchmarkMixedPrecision), the conversions costing more than the smaller loads save.
+class CompactParticleStore : public ParticleAccessors<CompactParticleStore> {
+private:
+    typedef std::vector<std::int32_t, AlignedAllocator<std::int32_t>> FixedArray;
+    typedef std::vector<std::uint16_t, AlignedAllocator<std::uint16_t>> HalfArray;
+
+    FixedArray xs, ys;
+    HalfArray vxs, vys;
+    AlignedFloats fxs, fys;
+    HalfArray densities;
+    HalfArray pressures;
+
+    template <typename Fn>
+    void forEachArray(Fn fn) {
+        fn(xs);
+        fn(ys);
+        fn(vxs);
+        fn(vys);
+        fn(fxs);
+        fn(fys);
+        fn(densities);
+        fn(pressures);
+    }
+public:
+    size_t size() const { return xs.size(); }
+    void resize(size_t count) { forEachArray([&](auto& array) { array.resize(count, 0); }); }
+    void reserve(size_t count) { forEachArray([&](auto& array) { array.reserve(count); }); }
+    void clear() { forEachArray([](auto& array) { array.clear(); }); }
+
+    void swap(CompactParticleStore& other) {
+        xs.swap(other.xs);
+        ys.swap(other.ys);
+        vxs.swap(other.vxs);
+        vys.swap(other.vys);
+        fxs.swap(other.fxs);
+        fys.swap(other.fys);
+        densities.swap(other.densities);
+        pressures.swap(other.pressures);
+    }
+
+    // Copies the packed bits, no conversion
+    void gather(const CompactParticleStore& source, const int* order, size_t begin, size_t end) {
+        auto gatherArray = [&](auto& to, const auto& from) {
+            for (size_t k = begin; k < end; k++) {
+                to[k] = from[order[k]];
+            }
+        };
+        gatherArray(xs, source.xs);
+        gatherArray(ys, source.ys);
+        gatherArray(vxs, source.vxs);
+        gatherArray(vys, source.vys);
+        gatherArray(fxs, source.fxs);
+        gatherArray(fys, source.fys);
+        gatherArray(densities, source.densities);
+        gatherArray(pressures, source.pressures);
+    }
+
+    FixedPositionRef x(size_t i) { return FixedPositionRef(xs[i]); }
+    FixedPositionRef y(size_t i) { return FixedPositionRef(ys[i]); }
+    HalfRef vx(size_t i) { return HalfRef(vxs[i]); }
+    HalfRef vy(size_t i) { return HalfRef(vys[i]); }
+    float& fx(size_t i) { return fxs[i]; }
+    float& fy(size_t i) { return fys[i]; }
+    HalfRef density(size_t i) { return HalfRef(densities[i]); }
+    HalfPressureRef pressure(size_t i) { return HalfPressureRef(pressures[i]); }
+    float x(size_t i) const { return fixedToFloat(xs[i]); }
+    float y(size_t i) const { return fixedToFloat(ys[i]); }
+    float vx(size_t i) const { return halfToFloat(vxs[i]); }
+    float vy(size_t i) const { return halfToFloat(vys[i]); }
+    float fx(size_t i) const { return fxs[i]; }
+    float fy(size_t i) const { return fys[i]; }
+    float density(size_t i) const { return halfToFloat(densities[i]); }
+    float pressure(size_t i) const { return halfToPressure(pressures[i]); }
+
+    std::int32_t* xData() { return xs.data(); }
+    std::int32_t* yData() { return ys.data(); }
+    std::uint16_t* vxData() { return vxs.data(); }
+    std::uint16_t* vyData() { return vys.data(); }
+    const std::uint16_t* vxData() const { return vxs.data(); }
+    const std::uint16_t* vyData() const { return vys.data(); }
+    const float* fxData() const { return fxs.data(); }
+    const float* fyData() const { return fys.data(); }
+    const std::uint16_t* densityData() const { return densities.data(); }
+    const std::uint16_t* pressureData() const { return pressures.data(); }
+};
+
+// Particle storage layout of FluidSimulator, chosen at compile time:
+// 0 array of structures, 1 structure of arrays, 2 SIMD-width blocks (AoSoA),
+// 3 mixed precision structure of arrays
+#ifndef PARTICLE_LAYOUT
+#define PARTICLE_LAYOUT 1
+#endif
+
+#if PARTICLE_LAYOUT == 0
+typedef AoSParticleStore ParticleStore;
+#elif PARTICLE_LAYOUT == 2
+typedef AoSoAParticleStore<SIMD_LANES> ParticleStore;
+#elif PARTICLE_LAYOUT == 3
+typedef CompactParticleStore ParticleStore;
+#else
+typedef SoAParticleStore ParticleStore;
+#endif
+
+// Identifies a particle for its whole lifetime, unlike its slot in the particle storage. The low
+// bits index the ID table, the high bits count how often that entry was handed out before, so
+// the ID of a removed particle does not find the particle that reuses its entry.
+typedef std::uint32_t ParticleId;
+const ParticleId INVALID_PARTICLE_ID = 0xFFFFFFFFu;
+const int PARTICLE_ID_INDEX_BITS = 22;
+const ParticleId PARTICLE_ID_INDEX_MASK = (1u << PARTICLE_ID_INDEX_BITS) - 1;
+const ParticleId PARTICLE_ID_GENERATIONS = 1u << (32 - PARTICLE_ID_INDEX_BITS);
+
+float dot(const sf::Vector2f& a, const sf::Vector2f& b) {
+    return a.x * b.x + a.y * b.y;
+}
+
+// Spreads the lower 16 bits of v so that a zero bit sits between each of them
+unsigned int mortonSpread(unsigned int v) {
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Z-order key of a cell, nearby cells get nearby keys
+unsigned int mortonCode(unsigned int cx, unsigned int cy) {
+    return mortonSpread(cx) | (mortonSpread(cy) << 1);
+}
+
+// Counter-based random stream (splitmix64): stream index of a given seed always yields the
+// same numbers, whichever thread draws them and in whatever order
+class SpawnRandom {
+private:
+    std::uint64_t state;
+public:
+    SpawnRandom(std::uint32_t seed, std::uint64_t index)
+        : state((static_cast<std::uint64_t>(seed) << 32) ^ (index * 0xD1B54A32D192ED03ull)) {}
+
+    std::uint64_t next() {
+        std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [-1, 1)
+    float nextSigned() {
+        return static_cast<float>(next() >> 40) * (2.f / 16777216.f) - 1.f;
+    }
+};
+
+// Persistent worker threads for the data-parallel passes. The calling thread takes part
+// in every job, and jobs are handed over without allocating, so the pool can be used
+// from inside the frame loop.
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    void (*job)(void*, int) = nullptr;
+    void* jobContext = nullptr;
+    int taskCount = 0;
+    std::atomic<int> nextTask{0};
+    int busyWorkers = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+
+    template <typename Fn>
+    static void invokeTask(void* context, int task) {
+        (*static_cast<Fn*>(context))(task);
+    }
+
+    void drainTasks() {
+        for (int task = nextTask++; task < taskCount; task = nextTask++) {
+            job(jobContext, task);
+        }
+    }
+
+    void workerLoop() {
+        unsigned int seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+
+            lock.unlock();
+            drainTasks();
+            lock.lock();
+            if (--busyWorkers == 0) done.notify_one();
+        }
+    }
+public:
+    explicit WorkerPool(int threads) {
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Threads that work on a job, including the caller
+    int getThreadCount() const {
+        return static_cast<int>(workers.size()) + 1;
+    }
+
+    // Runs fn(task) for every task in [0, tasks) and returns once all of them finished
+    template <typename Fn>
+    void run(int tasks, Fn& fn) {
+        if (workers.empty() || tasks <= 1) {
+            for (int task = 0; task < tasks; task++) fn(task);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &invokeTask<Fn>;
+            jobContext = &fn;
+            taskCount = tasks;
+            nextTask = 0;
+            busyWorkers = static_cast<int>(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        drainTasks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return busyWorkers == 0; });
+    }
+
+    // Splits [begin, end) into chunks of at least minChunk and runs fn(chunkBegin, chunkEnd) on each
+    template <typename Fn>
+    void parallelFor(size_t begin, size_t end, Fn&& fn, size_t minChunk = 4096) {
+        if (end <= begin) return;
+        const size_t count = end - begin;
+        const size_t chunks = std::max<size_t>(1, std::min<size_t>(4 * getThreadCount(), count / minChunk));
+        auto task = [&](int t) {
+            fn(begin + count * t / chunks, begin + count * (t + 1) / chunks);
+        };
+        run(static_cast<int>(chunks), task);
+    }
+};
+
+WorkerPool& sharedWorkerPool() {
+    static WorkerPool pool(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+    return pool;
+}
+
+// Stable LSD radix sort over 32-bit keys, 8 bits per pass. Every pass builds per-chunk
+// histograms and scatters the chunks in parallel; passes whose digit is the same for
+// all keys are skipped. Buffers are kept between calls.
+class RadixSorter {
+private:
+    static const int RADIX = 256;
+    static const size_t CHUNK_KEYS = 16384;     // fewest keys worth a parallel chunk
+    std::vector<unsigned int> keysA, keysB;
+    std::vector<int> orderA, orderB;
+    std::vector<size_t> offsets;    // chunks * RADIX
+public:
+    static const size_t DISORDER_DISTANCE = 64;
+    static const float MIN_DISORDER;
+
+    // Fraction of keys smaller than the key DISORDER_DISTANCE places before them: 0 for sorted
+    // keys and keys that only moved a few places, about 0.5 for random keys
+    static float disorder(const std::vector<unsigned int>& keys) {
+        if (keys.size() <= DISORDER_DISTANCE) return 0.f;
+        size_t descents = 0;
+        for (size_t k = DISORDER_DISTANCE; k < keys.size(); k++) {
+            descents += keys[k] < keys[k - DISORDER_DISTANCE];
+        }
+        return static_cast<float>(descents) / (keys.size() - DISORDER_DISTANCE);
+    }
+
+    // std::sort gets faster the fewer keys are far from their place, the radix sort does not, so
+    // the radix sort is taken from MIN_DISORDER on (see benchmarkRadixSort)
+    static bool pays(const std::vector<unsigned int>& keys) {
+        return disorder(keys) >= MIN_DISORDER;
+    }
+
+    // Writes order so that keys[order[0]] <= keys[order[1]] <= ..., equal keys in index
+    // order. Radix sorts only where that pays and uses std::sort otherwise. MIN_DISORDER = 0.05
+    // is provisional: it was fit with benchmarkRadixSort on one single-core machine, where the
+    // radix sort runs in a single chunk. More threads only speed up the radix sort, so on
+    // multi-core machines the threshold is likely too high and should be fit again there.
+    void sort(const std::vector<unsigned int>& keys, std::vector<int>& order, WorkerPool& pool) {
+        if (pays(keys)) {
+            radixSort(keys, order, pool);
+            return;
+        }
+        order.resize(keys.size());
+        for (size_t k = 0; k < order.size(); k++) order[k] = static_cast<int>(k);
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+        });
+    }
+
+    // sort() that always takes the radix path
+    void radixSort(const std::vector<unsigned int>& keys, std::vector<int>& order, WorkerPool& pool) {
+        const size_t count = keys.size();
+        const int chunks = static_cast<int>(std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), count / CHUNK_KEYS)));
+        keysA = keys;
+        keysB.resize(count);
+        orderA.resize(count);
+        orderB.resize(count);
+        offsets.resize(static_cast<size_t>(chunks) * RADIX);
+
+        auto chunkBegin = [&](int c) { return count * c / chunks; };
+
+        auto fillOrder = [&](int c) {
+            for (size_t k = chunkBegin(c); k < chunkBegin(c + 1); k++) orderA[k] = static_cast<int>(k);
+        };
+        pool.run(chunks, fillOrder);
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            auto countDigits = [&](int c) {
+                size_t* histogram = &offsets[static_cast<size_t>(c) * RADIX];
+                std::fill(histogram, histogram + RADIX, 0);
+                for (size_t k = chunkBegin(c); k < chunkBegin(c + 1); k++) {
+                    histogram[(keysA[k] >> shift) & (RADIX - 1)]++;
+                }
+            };
+            pool.run(chunks, countDigits);
+
+            // Digit-major, chunk-minor prefix sum keeps the sort stable
+            bool sorted = false;
+            size_t total = 0;
+            for (int digit = 0; digit < RADIX; digit++) {
+                size_t digitTotal = 0;
+                for (int c = 0; c < chunks; c++) {
+                    size_t n = offsets[static_cast<size_t>(c) * RADIX + digit];
+                    offsets[static_cast<size_t>(c) * RADIX + digit] = total;
+                    total += n;
+                    digitTotal += n;
+                }
+                if (digitTotal == count) sorted = true;
+            }
+            if (sorted) continue;
+
+            auto scatter = [&](int c) {
+                size_t* cursor = &offsets[static_cast<size_t>(c) * RADIX];
+                for (size_t k = chunkBegin(c); k < chunkBegin(c + 1); k++) {
+                    size_t slot = cursor[(keysA[k] >> shift) & (RADIX - 1)]++;
+                    keysB[slot] = keysA[k];
+                    orderB[slot] = orderA[k];
+                }
+            };
+            pool.run(chunks, scatter);
+            keysA.swap(keysB);
+            orderA.swap(orderB);
+        }
+
+        order.swap(orderA);
+        orderA.resize(count);
+    }
+};
+
+const float RadixSorter::MIN_DISORDER = 0.05f;
+
+enum class NeighborSearch {
+    BRUTE_FORCE,    // every pair, O(N^2) - the reference
+    UNIFORM_GRID,   // 3x3 cell neighborhood, O(N)
+    VERLET_LIST,    // per-particle lists with a skin, rebuilt only when particles moved far enough
+    SPATIAL_HASH,   // hashed cells, memory follows occupied cells instead of the domain area
+    INCREMENTAL_GRID, // uniform grid that only re-bins the particles which changed cells
+    QUADTREE        // Morton ordered tree, searches with each particle's own smoothing length
+};
+
+enum class PairEvaluation {
+    GATHER,     // every particle sums over its neighbors, each pair is computed from both sides
+    PAIR_ONCE,  // each unordered pair is computed once and applied to both particles
+    PAIR_LIST   // like PAIR_ONCE, from a per-step pair list with cached distances shared by both passes
+};
+
+// Interacting pair with the geometry both passes need, cached when the list is built
+struct NeighborPair {
+    int i;
+    int j;
+    sf::Vector2f diff;  // position i - position j
+    float r;
+    float invR;
+    float hMinusR;      // support of the pair - r, not positive outside the kernel support
+};
+
+// Uniform grid over the simulation bounds, rebuilt with a counting sort.
+// With cell size >= interaction radius every neighbor lies in the 3x3 cells around a particle.
+// A grid built with slack leaves free entries after each cell, so update() can move just
+// the particles that changed cells instead of sorting everything again.
+class UniformGrid {
+private:
+    sf::FloatRect domain;
+    float cellSize = 1.f;
+    float invCellSize = 1.f;
+    int cols = 0;
+    int rows = 0;
+    bool withSlack = false;
+    bool valid = false;
+
+    AlignedInts cellStart;          // cols * rows + 1 offsets into cellEntries, the next start ends a cell's capacity
+    AlignedInts cellFill;           // particles stored in each cell
+    AlignedInts cellEntries;        // particle indices grouped by cell
+    AlignedInts particleCell;       // current cell of each particle
+    AlignedInts particleSlot;       // index of each particle in cellEntries
+    std::vector<int> movedParticles;
+    std::vector<int> movedCells;
+    int lastMoved = 0;
+public:
+    template <typename Store>
+    void build(const Store& particles, const sf::FloatRect& bounds, float size, bool slack = false) {
+        domain = bounds;
+        cellSize = size;
+        invCellSize = 1.f / size;
+        cols = std::max(1, static_cast<int>(std::ceil(bounds.width * invCellSize)));
+        rows = std::max(1, static_cast<int>(std::ceil(bounds.height * invCellSize)));
+        withSlack = slack;
+        valid = true;
+        lastMoved = static_cast<int>(particles.size());
+
+        const size_t cellCount = static_cast<size_t>(cols) * rows;
+        cellStart.resize(cellCount + 1);
+        cellFill.assign(cellCount, 0);
+        particleCell.resize(particles.size());
+        particleSlot.resize(particles.size());
+
+        // Count particles per cell
+        for (size_t i = 0; i < particles.size(); i++) {
+            int cell = cellIndex(cellX(particles.x(i)), cellY(particles.y(i)));
+            particleCell[i] = cell;
+            cellFill[cell]++;
+        }
+
+        // Prefix sum turns counts (plus slack) into start offsets
+        int offset = 0;
+        for (size_t c = 0; c < cellCount; c++) {
+            cellStart[c] = offset;
+            offset += cellFill[c];
+            if (slack) offset += 2 + cellFill[c] / 4;
+            cellFill[c] = 0;
+        }
+        cellStart[cellCount] = offset;
+        cellEntries.resize(offset);
+
+        // Scatter indices, cellFill is the running cursor of each cell
+        for (size_t i = 0; i < particles.size(); i++) {
+            int cell = particleCell[i];
+            int slot = cellStart[cell] + cellFill[cell]++;
+            cellEntries[slot] = static_cast<int>(i);
+            particleSlot[i] = slot;
+        }
+    }
+
+    // Moves only the particles whose cell changed since the last build or update. Returns false,
+    // leaving a full build to the caller, when the grid was built differently, the particle count
+    // changed, more than maxMovedShare of the particles changed cells or a cell ran out of slack.
+    template <typename Store>
+    bool update(const Store& particles, const sf::FloatRect& bounds, float size, float maxMovedShare) {
+        if (!valid || !withSlack || size != cellSize || bounds != domain || particles.size() != particleCell.size()) {
+            return false;
+        }
+
+        const size_t maxMoved = static_cast<size_t>(maxMovedShare * particles.size());
+        movedParticles.clear();
+        movedCells.clear();
+        for (size_t i = 0; i < particles.size(); i++) {
+            int cell = cellIndex(cellX(particles.x(i)), cellY(particles.y(i)));
+            if (cell != particleCell[i]) {
+                if (movedParticles.size() >= maxMoved) return false;
+                movedParticles.push_back(static_cast<int>(i));
+                movedCells.push_back(cell);
+            }
+        }
+
+        for (size_t k = 0; k < movedParticles.size(); k++) {
+            const int i = movedParticles[k];
+            const int from = particleCell[i];
+            const int to = movedCells[k];
+            if (cellStart[to] + cellFill[to] == cellStart[to + 1]) {
+                valid = false; // partially updated, must be rebuilt
+                return false;
+            }
+
+            // The last particle of the old cell fills the hole
+            const int last = cellStart[from] + --cellFill[from];
+            const int swapped = cellEntries[last];
+            cellEntries[particleSlot[i]] = swapped;
+            particleSlot[swapped] = particleSlot[i];
+
+            const int slot = cellStart[to] + cellFill[to]++;
+            cellEntries[slot] = i;
+            particleSlot[i] = slot;
+            particleCell[i] = to;
+        }
+
+        lastMoved = static_cast<int>(movedParticles.size());
+        return true;
+    }
+
+    // Forces a full build, needed when particle indices change
+    void invalidate() {
+        valid = false;
+    }
+
+    // Particles that changed cells in the last update, all of them after a full build
+    int getLastMoved() const {
+        return lastMoved;
+    }
+
+    // Positions outside the domain are clamped to the border cells, which keeps
+    // neighboring particles at most one cell apart
+    int cellX(float x) const {
+        float cx = std::min(std::max(0.f, (x - domain.left) * invCellSize), static_cast<float>(cols - 1));
+        return static_cast<int>(cx);
+    }
+
+    int cellY(float y) const {
+        float cy = std::min(std::max(0.f, (y - domain.top) * invCellSize), static_cast<float>(rows - 1));
+        return static_cast<int>(cy);
+    }
+
+    int cellIndex(int cx, int cy) const {
+        return cy * cols + cx;
+    }
+
+    // Calls fn(j) for every particle in the 3x3 cells around pos, including the particle itself
+    template <typename Fn>
+    void forEachCandidate(const sf::Vector2f& pos, Fn&& fn) const {
+        const int cx = cellX(pos.x);
+        const int cy = cellY(pos.y);
+        const int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, cols - 1);
+        const int y0 = std::max(cy - 1, 0), y1 = std::min(cy + 1, rows - 1);
+
+        for (int y = y0; y <= y1; y++) {
+            if (!withSlack) {
+                // Without slack the cells of one row are adjacent in cellEntries
+                const int begin = cellStart[cellIndex(x0, y)];
+                const int end = cellStart[cellIndex(x1, y) + 1];
+                for (int k = begin; k < end; k++) {
+                    fn(cellEntries[k]);
+                }
+                continue;
+            }
+
+            for (int x = x0; x <= x1; x++) {
+                const int cell = cellIndex(x, y);
+                const int end = cellStart[cell] + cellFill[cell];
+                for (int k = cellStart[cell]; k < end; k++) {
+                    fn(cellEntries[k]);
+                }
+            }
+        }
+    }
+
+    // Calls fn(j) for every particle in the cells overlapping the rectangle
+    template <typename Fn>
+    void forEachInRect(float minX, float minY, float maxX, float maxY, Fn&& fn) const {
+        const int x0 = cellX(minX), x1 = cellX(maxX);
+        const int y0 = cellY(minY), y1 = cellY(maxY);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                const int cell = cellIndex(x, y);
+                const int end = cellStart[cell] + cellFill[cell];
+                for (int k = cellStart[cell]; k < end; k++) {
+                    fn(cellEntries[k]);
+                }
+            }
+        }
+    }
+
+    // Calls fn(i, j) once for every unordered pair of distinct particles in neighboring cells.
+    // Each cell is paired with itself and with the four cells after it in a half stencil.
+    template <typename Fn>
+    void forEachPair(Fn&& fn) const {
+        static const int FORWARD[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+        for (int cy = 0; cy < rows; cy++) {
+            for (int cx = 0; cx < cols; cx++) {
+                const int cell = cellIndex(cx, cy);
+                const int begin = cellStart[cell];
+                const int end = begin + cellFill[cell];
+                if (begin == end) continue;
+
+                for (int a = begin; a < end; a++) {
+                    for (int b = a + 1; b < end; b++) {
+                        fn(cellEntries[a], cellEntries[b]);
+                    }
+                }
+
+                for (const auto& offset : FORWARD) {
+                    const int nx = cx + offset[0];
+                    const int ny = cy + offset[1];
+                    if (nx < 0 || nx >= cols || ny >= rows) continue;
+
+                    const int other = cellIndex(nx, ny);
+                    const int otherEnd = cellStart[other] + cellFill[other];
+                    for (int a = begin; a < end; a++) {
+                        for (int b = cellStart[other]; b < otherEnd; b++) {
+                            fn(cellEntries[a], cellEntries[b]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+// Sparse alternative to UniformGrid for large or unbounded domains. Cells are keyed by
+// their integer coordinates in an open addressing table sized from the particle count,
+// so memory scales with occupied cells. Slots are reused between builds: a slot is
+// live only when its generation matches the current build.
+class SpatialHash {
+private:
+    struct Slot {
+        unsigned long long key = 0;
+        unsigned int generation = 0;
+        int start = 0;
+        int count = 0;
+    };
+
+    std::vector<Slot, AlignedAllocator<Slot>> table; // power of two, at least twice the occupied cells
+    std::vector<int> occupiedSlots;
+    AlignedInts cellEntries;        // particle indices grouped by cell
+    AlignedInts particleSlot;
+    unsigned int generation = 0;
+    float invCellSize = 1.f;
+
+    static unsigned long long makeKey(int cx, int cy) {
+        return (static_cast<unsigned long long>(static_cast<unsigned int>(cx)) << 32) |
+               static_cast<unsigned int>(cy);
+    }
+
+    size_t slotFor(unsigned long long key) const {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (table.size() - 1);
+    }
+
+    int cellCoord(float v) const {
+        // Clamp so that far away or invalid positions still map to a valid integer cell
+        float c = std::floor(v * invCellSize);
+        return static_cast<int>(std::min(std::max(-1e9f, c), 1e9f));
+    }
+
+    int findSlot(int cx, int cy) const {
+        const unsigned long long key = makeKey(cx, cy);
+        for (size_t s = slotFor(key); ; s = (s + 1) & (table.size() - 1)) {
+            const Slot& slot = table[s];
+            if (slot.generation != generation) return -1;
+            if (slot.key == key) return static_cast<int>(s);
+        }
+    }
+
+    int findOrInsertSlot(int cx, int cy) {
+        const unsigned long long key = makeKey(cx, cy);
+        for (size_t s = slotFor(key); ; s = (s + 1) & (table.size() - 1)) {
+            Slot& slot = table[s];
+            if (slot.generation != generation) {
+                slot.key = key;
+                slot.generation = generation;
+                slot.count = 0;
+                occupiedSlots.push_back(static_cast<int>(s));
+                return static_cast<int>(s);
+            }
+            if (slot.key == key) return static_cast<int>(s);
+        }
+    }
+public:
+    template <typename Store>
+    void build(const Store& particles, float cellSize) {
+        invCellSize = 1.f / cellSize;
+
+        // Occupied cells never exceed the particle count, keep the load factor at or below 1/2.
+        // Shrink only when the table is far too large so that steady state does not reallocate.
+        size_t capacity = 16;
+        while (capacity < 2 * particles.size()) capacity *= 2;
+        if (table.size() < capacity || table.size() > 8 * capacity) {
+            table.assign(capacity, Slot());
+            generation = 0;
+        }
+        generation++;
+        if (generation == 0) { // wrapped around, stale slots could look live
+            table.assign(table.size(), Slot());
+            generation = 1;
+        }
+
+        occupiedSlots.clear();
+        cellEntries.resize(particles.size());
+        particleSlot.resize(particles.size());
+
+        // Count particles per cell
+        for (size_t i = 0; i < particles.size(); i++) {
+            int slot = findOrInsertSlot(cellCoord(particles.x(i)), cellCoord(particles.y(i)));
+            particleSlot[i] = slot;
+            table[slot].count++;
+        }
+
+        // Assign each occupied cell its range, count becomes the fill cursor
+        int offset = 0;
+        for (int s : occupiedSlots) {
+            table[s].start = offset;
+            offset += table[s].count;
+            table[s].count = 0;
+        }
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            Slot& slot = table[particleSlot[i]];
+            cellEntries[slot.start + slot.count++] = static_cast<int>(i);
+        }
+    }
+
+    // Calls fn(j) for every particle in the 3x3 cells around pos, including the particle itself
+    template <typename Fn>
+    void forEachCandidate(const sf::Vector2f& pos, Fn&& fn) const {
+        const int cx = cellCoord(pos.x);
+        const int cy = cellCoord(pos.y);
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                int s = findSlot(x, y);
+                if (s < 0) continue;
+                const Slot& slot = table[s];
+                for (int k = slot.start; k < slot.start + slot.count; k++) {
+                    fn(cellEntries[k]);
+                }
+            }
+        }
+    }
+
+    // Calls fn(j) for every particle in the cells overlapping the rectangle. Large rectangles
+    // walk the occupied cells instead of probing every cell they cover.
+    template <typename Fn>
+    void forEachInRect(float minX, float minY, float maxX, float maxY, Fn&& fn) const {
+        const int x0 = cellCoord(minX), x1 = cellCoord(maxX);
+        const int y0 = cellCoord(minY), y1 = cellCoord(maxY);
+        const double covered = (static_cast<double>(x1) - x0 + 1) * (static_cast<double>(y1) - y0 + 1);
+
+        if (covered > static_cast<double>(occupiedSlots.size())) {
+            for (int s : occupiedSlots) {
+                const Slot& slot = table[s];
+                const int cx = static_cast<int>(slot.key >> 32);
+                const int cy = static_cast<int>(slot.key & 0xFFFFFFFFull);
+                if (cx < x0 || cx > x1 || cy < y0 || cy > y1) continue;
+                for (int k = slot.start; k < slot.start + slot.count; k++) {
+                    fn(cellEntries[k]);
+                }
+            }
+            return;
+        }
+
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                int s = findSlot(x, y);
+                if (s < 0) continue;
+                const Slot& slot = table[s];
+                for (int k = slot.start; k < slot.start + slot.count; k++) {
+                    fn(cellEntries[k]);
+                }
+            }
+        }
+    }
+
+    // Calls fn(i, j) once for every unordered pair of distinct particles in neighboring cells
+    template <typename Fn>
+    void forEachPair(Fn&& fn) const {
+        static const int FORWARD[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+        for (int s : occupiedSlots) {
+            const Slot& slot = table[s];
+            const int begin = slot.start;
+            const int end = slot.start + slot.count;
+            const int cx = static_cast<int>(slot.key >> 32);
+            const int cy = static_cast<int>(slot.key & 0xFFFFFFFFull);
+
+            for (int a = begin; a < end; a++) {
+                for (int b = a + 1; b < end; b++) {
+                    fn(cellEntries[a], cellEntries[b]);
+                }
+            }
+
+            for (const auto& offset : FORWARD) {
+                int other = findSlot(cx + offset[0], cy + offset[1]);
+                if (other < 0) continue;
+
+                const Slot& neighbor = table[other];
+                for (int a = begin; a < end; a++) {
+                    for (int b = neighbor.start; b < neighbor.start + neighbor.count; b++) {
+                        fn(cellEntries[a], cellEntries[b]);
+                    }
+                }
+            }
+        }
+    }
+
+    size_t getOccupiedCells() const {
+        return occupiedSlots.size();
+    }
+
+    size_t getMemoryBytes() const {
+        return table.capacity() * sizeof(Slot) +
+               (occupiedSlots.capacity() + cellEntries.capacity() + particleSlot.capacity()) * sizeof(int);
+    }
+};
+
+// Neighbor search with a search radius per particle. Particles are Morton sorted and packed
+// into leaves of LEAF_SIZE, then every level groups four consecutive nodes of the level
+// below, so the tree adapts to particle density and is built bottom-up one level at a
+// time, each level in parallel. Nodes store tight bounds and the largest search radius
+// inside them, so a query can also reach particles whose own radius covers it. The simulator
+// passes the smoothing lengths: SYMMETRIC queries then find every pair within the mean of both,
+// which is never larger than the larger of the two.
+class Quadtree {
+public:
+    enum QueryMode {
+        GATHER,     // j within the search radius of the querying particle
+        SYMMETRIC   // j within the larger of both search radii
+    };
+private:
+    struct Node {
+        float minX, minY, maxX, maxY;
+        float maxRadius;
+    };
+
+    static const int LEAF_SIZE = 8;
+    std::vector<Node> nodes;            // leaves first, root last
+    std::vector<int> levelStart;        // first node of each level, plus the end
+    std::vector<int> sortedIndex;       // particle indices in Morton order
+    std::vector<float> radius;          // search radius of each particle
+    std::vector<unsigned int> keys;
+    std::vector<float> chunkBounds;
+    RadixSorter sorter;
+
+    static float distanceSq(const Node& node, const sf::Vector2f& pos) {
+        float dx = std::max(std::max(node.minX - pos.x, pos.x - node.maxX), 0.f);
+        float dy = std::max(std::max(node.minY - pos.y, pos.y - node.maxY), 0.f);
+        return dx * dx + dy * dy;
+    }
+public:
+    // radii[i] <= 0 or an empty radii vector selects defaultRadius, radii below minRadius are
+    // raised to it
+    template <typename Store>
+    void build(const Store& particles, const std::vector<float>& radii, float defaultRadius,
+               WorkerPool& pool, float minRadius = 0.f) {
+        const size_t count = particles.size();
+        nodes.clear();
+        levelStart.assign(1, 0);
+        if (count == 0) return;
+
+        // Bounding box of all particles, reduced per chunk
+        const int chunks = static_cast<int>(std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), count / 4096)));
+        chunkBounds.resize(4 * chunks);
+        auto reduceBounds = [&](int c) {
+            float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+            for (size_t i = count * c / chunks; i < count * (c + 1) / chunks; i++) {
+                const sf::Vector2f pos = particles.position(i);
+                minX = std::min(minX, pos.x); maxX = std::max(maxX, pos.x);
+                minY = std::min(minY, pos.y); maxY = std::max(maxY, pos.y);
+            }
+            chunkBounds[4 * c] = minX; chunkBounds[4 * c + 1] = minY;
+            chunkBounds[4 * c + 2] = maxX; chunkBounds[4 * c + 3] = maxY;
+        };
+        pool.run(chunks, reduceBounds);
+        float minX = chunkBounds[0], minY = chunkBounds[1], maxX = chunkBounds[2], maxY = chunkBounds[3];
+        for (int c = 1; c < chunks; c++) {
+            minX = std::min(minX, chunkBounds[4 * c]); minY = std::min(minY, chunkBounds[4 * c + 1]);
+            maxX = std::max(maxX, chunkBounds[4 * c + 2]); maxY = std::max(maxY, chunkBounds[4 * c + 3]);
+        }
+        const float scale = 65535.f / std::max(std::max(maxX - minX, maxY - minY), 0.0001f);
+
+        keys.resize(count);
+        radius.resize(count);
+        pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                float cx = std::min(std::max(0.f, (particles.x(i) - minX) * scale), 65535.f);
+                float cy = std::min(std::max(0.f, (particles.y(i) - minY) * scale), 65535.f);
+                keys[i] = mortonCode(static_cast<unsigned int>(cx), static_cast<unsigned int>(cy));
+                radius[i] = std::max((i < radii.size() && radii[i] > 0.f) ? radii[i] : defaultRadius, minRadius);
+            }
+        });
+        sorter.sort(keys, sortedIndex, pool);
+
+        // Size every level up front, a level has a quarter of the nodes of the one below
+        int levelNodes = static_cast<int>((count + LEAF_SIZE - 1) / LEAF_SIZE);
+        levelStart.push_back(levelNodes);
+        while (levelNodes > 1) {
+            levelNodes = (levelNodes + 3) / 4;
+            levelStart.push_back(levelStart.back() + levelNodes);
+        }
+        nodes.resize(levelStart.back());
+
+        // Leaves from runs of Morton sorted particles
+        pool.parallelFor(0, levelStart[1], [&](size_t begin, size_t end) {
+            for (size_t leaf = begin; leaf < end; leaf++) {
+                Node node = {1e30f, 1e30f, -1e30f, -1e30f, 0.f};
+                for (size_t k = leaf * LEAF_SIZE; k < std::min(count, (leaf + 1) * LEAF_SIZE); k++) {
+                    const int i = sortedIndex[k];
+                    const sf::Vector2f pos = particles.position(i);
+                    node.minX = std::min(node.minX, pos.x); node.maxX = std::max(node.maxX, pos.x);
+                    node.minY = std::min(node.minY, pos.y); node.maxY = std::max(node.maxY, pos.y);
+                    node.maxRadius = std::max(node.maxRadius, radius[i]);
+                }
+                nodes[leaf] = node;
+            }
+        }, 1024);
+
+        // Each parent merges its four children
+        for (size_t level = 1; level + 1 < levelStart.size(); level++) {
+            const int childBegin = levelStart[level - 1];
+            const int childEnd = levelStart[level];
+            const int parentBegin = levelStart[level];
+            pool.parallelFor(0, levelStart[level + 1] - parentBegin, [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; k++) {
+                    Node node = {1e30f, 1e30f, -1e30f, -1e30f, 0.f};
+                    for (int child = childBegin + 4 * static_cast<int>(k);
+                         child < std::min(childBegin + 4 * static_cast<int>(k) + 4, childEnd); child++) {
+                        const Node& c = nodes[child];
+                        node.minX = std::min(node.minX, c.minX); node.maxX = std::max(node.maxX, c.maxX);
+                        node.minY = std::min(node.minY, c.minY); node.maxY = std::max(node.maxY, c.maxY);
+                        node.maxRadius = std::max(node.maxRadius, c.maxRadius);
+                    }
+                    nodes[parentBegin + k] = node;
+                }
+            }, 1024);
+        }
+    }
+
+    float getRadius(size_t i) const {
+        return radius[i];
+    }
+
+    // Calls fn(j) for every particle j within the query radius of pos, which includes the
+    // querying particle itself. h is the search radius of the querying particle.
+    template <typename Store, typename Fn>
+    void forEachNeighbor(const Store& particles, const sf::Vector2f& pos, float h,
+                         QueryMode mode, Fn&& fn) const {
+        if (nodes.empty()) return;
+
+        // Depth is log4 of the leaf count, at most three siblings wait per level
+        int stackLevel[96];
+        int stackNode[96];
+        int top = 0;
+        stackLevel[top] = static_cast<int>(levelStart.size()) - 2;
+        stackNode[top] = levelStart[stackLevel[top]];
+        top++;
+
+        while (top > 0) {
+            top--;
+            const int level = stackLevel[top];
+            const int index = stackNode[top];
+            const Node& node = nodes[index];
+            const float reach = mode == SYMMETRIC ? std::max(h, node.maxRadius) : h;
+            if (distanceSq(node, pos) >= reach * reach) continue;
+
+            if (level == 0) {
+                const size_t count = sortedIndex.size();
+                for (size_t k = static_cast<size_t>(index) * LEAF_SIZE;
+                     k < std::min(count, static_cast<size_t>(index + 1) * LEAF_SIZE); k++) {
+                    const int j = sortedIndex[k];
+                    const sf::Vector2f diff = pos - particles.position(j);
+                    const float r = mode == SYMMETRIC ? std::max(h, radius[j]) : h;
+                    if (diff.x * diff.x + diff.y * diff.y < r * r) {
+                        fn(j);
+                    }
+                }
+                continue;
+            }
+
+            const int firstChild = levelStart[level - 1] + 4 * (index - levelStart[level]);
+            const int lastChild = std::min(firstChild + 4, levelStart[level]);
+            for (int child = lastChild - 1; child >= firstChild; child--) {
+                stackLevel[top] = level - 1;
+                stackNode[top] = child;
+                top++;
+            }
+        }
+    }
+
+    // Calls fn(j) for every particle in the leaves overlapping the rectangle
+    template <typename Fn>
+    void forEachInRect(float minX, float minY, float maxX, float maxY, Fn&& fn) const {
+        if (nodes.empty()) return;
+
+        int stackLevel[96];
+        int stackNode[96];
+        int top = 0;
+        stackLevel[top] = static_cast<int>(levelStart.size()) - 2;
+        stackNode[top] = levelStart[stackLevel[top]];
+        top++;
+
+        while (top > 0) {
+            top--;
+            const int level = stackLevel[top];
+            const int index = stackNode[top];
+            const Node& node = nodes[index];
+            if (node.minX > maxX || node.maxX < minX || node.minY > maxY || node.maxY < minY) continue;
+
+            if (level == 0) {
+                const size_t count = sortedIndex.size();
+                for (size_t k = static_cast<size_t>(index) * LEAF_SIZE;
+                     k < std::min(count, static_cast<size_t>(index + 1) * LEAF_SIZE); k++) {
+                    fn(sortedIndex[k]);
+                }
+                continue;
+            }
+
+            const int firstChild = levelStart[level - 1] + 4 * (index - levelStart[level]);
+            const int lastChild = std::min(firstChild + 4, levelStart[level]);
+            for (int child = lastChild - 1; child >= firstChild; child--) {
+                stackLevel[top] = level - 1;
+                stackNode[top] = child;
+                top++;
+            }
+        }
+    }
+
+    size_t getNodeCount() const {
+        return nodes.size();
+    }
+};
+
+// Per-particle neighbor lists gathered with radius cutoff + skin. They stay valid
+// until some particle has moved more than half the skin since the last build. With the
+// current pressure and collision constants a pool never comes to rest (benchmarkSettledPool
+// measures moves near MAX_VELOCITY * dt every step), so in practice they rebuild each step.
+// Compressed lists store each neighbor j of particle i as the 16-bit offset j - i. After
+// the Morton reordering nearly all neighbors sit within that range; the rest are written
+// as ESCAPE followed by the full index in two 16-bit halves.
+class VerletLists {
+private:
+    enum : std::int16_t { ESCAPE = -32768 };
+
+    AlignedInts listStart;                      // N + 1 offsets into neighbors or codes
+    AlignedInts neighbors;                      // includes the particle itself
+    std::vector<std::int16_t, AlignedAllocator<std::int16_t>> codes; // compressed lists
+    std::vector<sf::Vector2f> buildPositions;
+    float buildCutoff = 0.f;
+    float buildSkin = 0.f;
+    bool compressed = false;
+    int escapes = 0;
+
+    void appendCode(int i, int j) {
+        const int offset = j - i;
+        if (offset > ESCAPE && offset <= 32767) {
+            codes.push_back(static_cast<std::int16_t>(offset));
+        } else {
+            codes.push_back(ESCAPE);
+            codes.push_back(static_cast<std::int16_t>(j & 0xFFFF));
+            codes.push_back(static_cast<std::int16_t>(j >> 16));
+            escapes++;
+        }
+    }
+
+    // Calls fn(j) for the compressed list entries [begin, end) of particle i
+    template <typename Fn>
+    void decode(int i, int begin, int end, Fn&& fn) const {
+        for (int k = begin; k < end; k++) {
+            int j;
+            if (codes[k] != ESCAPE) {
+                j = i + codes[k];
+            } else {
+                j = static_cast<std::uint16_t>(codes[k + 1]) | (static_cast<int>(codes[k + 2]) << 16);
+                k += 2;
+            }
+            fn(j);
+        }
+    }
+public:
+    template <typename Store>
+    bool needsRebuild(const Store& particles, float cutoff, float skin) const {
+        if (particles.size() != buildPositions.size() || cutoff != buildCutoff || skin != buildSkin) {
+            return true;
+        }
+
+        const float limitSq = 0.25f * skin * skin;
+        for (size_t i = 0; i < particles.size(); i++) {
+            sf::Vector2f moved = particles.position(i) - buildPositions[i];
+            if (dot(moved, moved) > limitSq) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // grid must have been built with cell size >= cutoff + skin
+    template <typename Store>
+    void build(const Store& particles, const UniformGrid& grid, float cutoff, float skin, bool compress = false) {
+        const float radiusSq = (cutoff + skin) * (cutoff + skin);
+        buildCutoff = cutoff;
+        buildSkin = skin;
+        compressed = compress;
+        escapes = 0;
+        buildPositions.resize(particles.size());
+        listStart.resize(particles.size() + 1);
+        neighbors.clear();
+        codes.clear();
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            const sf::Vector2f pos = particles.position(i);
+            buildPositions[i] = pos;
+            listStart[i] = static_cast<int>(compressed ? codes.size() : neighbors.size());
+            grid.forEachCandidate(pos, [&](int j) {
+                sf::Vector2f diff = pos - particles.position(j);
+                if (dot(diff, diff) < radiusSq) {
+                    if (compressed) {
+                        appendCode(static_cast<int>(i), j);
+                    } else {
+                        neighbors.push_back(j);
+                    }
+                }
+            });
+        }
+        listStart[particles.size()] = static_cast<int>(compressed ? codes.size() : neighbors.size());
+    }
+
+    bool isCompressed() const {
+        return compressed;
+    }
+
+    // Neighbors that did not fit a 16-bit offset in the last compressed build
+    int getEscapeCount() const {
+        return escapes;
+    }
+
+    // Bytes the current lists take up, excluding spare capacity
+    size_t getMemoryBytes() const {
+        return listStart.size() * sizeof(int) + neighbors.size() * sizeof(int) +
+               codes.size() * sizeof(std::int16_t);
+    }
+
+    // Forces a rebuild on the next step, needed when particle indices change
+    void invalidate() {
+        buildPositions.clear();
+    }
+
+    template <typename Fn>
+    void forEachNeighbor(size_t i, Fn&& fn) const {
+        if (compressed) {
+            decode(static_cast<int>(i), listStart[i], listStart[i + 1], fn);
+            return;
+        }
+        for (int k = listStart[i]; k < listStart[i + 1]; k++) {
+            fn(neighbors[k]);
+        }
+    }
+
+    // The lists are symmetric, so keeping j > i visits every pair once
+    template <typename Fn>
+    void forEachPair(Fn&& fn) const {
+        const int count = static_cast<int>(listStart.size()) - 1;
+        for (int i = 0; i < count; i++) {
+            if (compressed) {
+                decode(i, listStart[i], listStart[i + 1], [&](int j) {
+                    if (j > i) fn(i, j);
+                });
+                continue;
+            }
+            for (int k = listStart[i]; k < listStart[i + 1]; k++) {
+                if (neighbors[k] > i) fn(i, neighbors[k]);
+            }
+        }
+    }
+};
+
+class FPSCounter {
+private:
+    float fps;
+    sf::Clock clock;
+    sf::Time previousTime;
+
+    static const int SAMPLE_SIZE = 10;
+    std::array<float, SAMPLE_SIZE> fpsHistory;
+    int currentSample = 0;
+
+    // One prebuilt text per character the counter shows, drawn side by side, so a frame
+    // neither formats a std::string nor rebuilds text geometry
+    static const int GLYPH_COUNT = 11; // digits and the decimal point
+    sf::Text glyphTexts[GLYPH_COUNT];
+    float glyphAdvances[GLYPH_COUNT];
+    sf::Text suffixText;
+    const sf::Font* glyphFont = nullptr;
+    unsigned int glyphSize = 0;
+
+    void buildGlyphs(const sf::Font& font, unsigned int characterSize) {
+        const char* glyphs = "0123456789.";
+        for (int g = 0; g < GLYPH_COUNT; g++) {
+            glyphTexts[g].setFont(font);
+            glyphTexts[g].setString(sf::String(glyphs[g]));
+            glyphTexts[g].setCharacterSize(characterSize);
+            glyphTexts[g].setFillColor(sf::Color::White);
+            glyphAdvances[g] = font.getGlyph(static_cast<unsigned char>(glyphs[g]), characterSize, false).advance;
+        }
+        suffixText.setFont(font);
+        suffixText.setString(" FPS");
+        suffixText.setCharacterSize(characterSize);
+        suffixText.setFillColor(sf::Color::White);
+        glyphFont = &font;
+        glyphSize = characterSize;
+    }
+
+public:
+    FPSCounter() : fps(0.0f), currentSample(0) {
+        previousTime = clock.getElapsedTime();
+        fpsHistory.fill(0.0f);
+    }
+
+    void update() {
+        sf::Time currentTime = clock.getElapsedTime();
+        sf::Time deltaTime = currentTime - previousTime;
+        previousTime = currentTime;
+
+        // Calculate instantaneous fps
+        float currentFps = 1.0f / deltaTime.asSeconds();
+
+        // Store in circular buffer
+        fpsHistory[currentSample] = currentFps;
+        currentSample = (currentSample + 1) % SAMPLE_SIZE;
+
+        // Calculate average fps
+        float sum = 0.0f;
+        for (float sample : fpsHistory) {
+            sum += sample;
+        }
+        fps = sum / SAMPLE_SIZE;
+    }
+
+    float getFPS() const {
+        return fps;
+    }
+
+    void draw(sf::RenderTarget& target, const sf::Font& font,
+             unsigned int characterSize = 20,
+             sf::Vector2f position = sf::Vector2f(27, 25)) {
+        if (glyphFont != &font || glyphSize != characterSize) {
+            buildGlyphs(font, characterSize);
+        }
+
+        char digits[32];
+        int length = std::snprintf(digits, sizeof(digits), "%.1f", fps);
+        float x = position.x;
+        for (int k = 0; k < length && k < static_cast<int>(sizeof(digits)) - 1; k++) {
+            int g = digits[k] == '.' ? 10 : digits[k] - '0';
+            if (g < 0 || g >= GLYPH_COUNT) continue; // sign or inf before the first frame time
+            glyphTexts[g].setPosition(x, position.y);
+            target.draw(glyphTexts[g]);
+            x += glyphAdvances[g];
+        }
+        suffixText.setPosition(x, position.y);
+        target.draw(suffixText);
+    }
+};
+
+// SPH kernel support radius. It is a compile-time constant so every kernel coefficient below
+// folds into a single float.
+constexpr float KERNEL_SUPPORT = 15.f;
+constexpr float KERNEL_SUPPORT_SQ = KERNEL_SUPPORT * KERNEL_SUPPORT;
+constexpr float KERNEL_PI = 3.14159265358979f;
+
+constexpr float kernelPow(float x, int n) {
+    return n == 0 ? 1.f : x * kernelPow(x, n - 1);
+}
+
+// Kernel policies. value(r2) gives W from the squared distance, gradient(r) dW/dr and laplacian(r)
+// the Laplacian, each for r inside the support; the callers test the support themselves.
+//
+// The simulation constants were tuned with Poly6, the Spiky gradient and the viscosity Laplacian
+// at their 3D coefficients. The cubic spline and Wendland C2 are normalized in 2D and then scaled
+// by the same gains relative to a normalized 2D kernel, so they drop in without retuning.
+constexpr float DENSITY_KERNEL_GAIN = 315.f * kernelPow(KERNEL_SUPPORT, 4) / 256.f;
+constexpr float GRADIENT_KERNEL_GAIN = 1.5f / KERNEL_SUPPORT;
+
+struct Poly6Kernel {
+    static constexpr float SCALE = 315.f / (64.f * KERNEL_PI * kernelPow(KERNEL_SUPPORT, 4));
+
+    static float value(float r2) {
+        const float q = KERNEL_SUPPORT_SQ - r2;
+        return SCALE * q * q * q;
+    }
+};
+
+struct SpikyGradientKernel {
+    static constexpr float SCALE = -45.f / (KERNEL_PI * kernelPow(KERNEL_SUPPORT, 6));
+
+    static float gradient(float r) {
+        const float q = KERNEL_SUPPORT - r;
+        return SCALE * q * q;
+    }
+};
+
+struct ViscosityLaplacianKernel {
+    static constexpr float SCALE = 45.f / (KERNEL_PI * kernelPow(KERNEL_SUPPORT, 6));
+
+    static float laplacian(float r) {
+        return SCALE * (KERNEL_SUPPORT - r);
+    }
+};
+
+// Monaghan's M4 spline over q = r / KERNEL_SUPPORT, with its knot at q = 1/2
+struct CubicSplineKernel {
+    static constexpr float SCALE = DENSITY_KERNEL_GAIN * 40.f / (7.f * KERNEL_PI * KERNEL_SUPPORT_SQ);
+    static constexpr float GRADIENT_SCALE =
+        GRADIENT_KERNEL_GAIN * 40.f / (7.f * KERNEL_PI * KERNEL_SUPPORT_SQ * KERNEL_SUPPORT);
+
+    static float value(float r2) {
+        const float q = std::sqrt(r2) * (1.f / KERNEL_SUPPORT);
+        if (q < 0.5f) {
+            return SCALE * (1.f - 6.f * q * q + 6.f * q * q * q);
+        }
+        const float t = 1.f - q;
+        return SCALE * 2.f * t * t * t;
+    }
+
+    static float gradient(float r) {
+        const float q = r * (1.f / KERNEL_SUPPORT);
+        if (q < 0.5f) {
+            return GRADIENT_SCALE * q * (18.f * q - 12.f);
+        }
+        const float t = 1.f - q;
+        return GRADIENT_SCALE * -6.f * t * t;
+    }
+};
+
+// Wendland C2, (1 - q)^4 (1 + 4q), no tensile clumping and a gradient that vanishes at r = 0
+struct WendlandC2Kernel {
+    static constexpr float SCALE = DENSITY_KERNEL_GAIN * 7.f / (KERNEL_PI * KERNEL_SUPPORT_SQ);
+    static constexpr float GRADIENT_SCALE =
+        GRADIENT_KERNEL_GAIN * -20.f * 7.f / (KERNEL_PI * KERNEL_SUPPORT_SQ * KERNEL_SUPPORT);
+
+    static float value(float r2) {
+        const float q = std::sqrt(r2) * (1.f / KERNEL_SUPPORT);
+        const float t = 1.f - q;
+        const float t2 = t * t;
+        return SCALE * t2 * t2 * (1.f + 4.f * q);
+    }
+
+    static float gradient(float r) {
+        const float q = r * (1.f / KERNEL_SUPPORT);
+        const float t = 1.f - q;
+        return GRADIENT_SCALE * q * t * t * t;
+    }
+};
+
+// SIMD kernels of the density, force and integrate passes. With GCC and Clang on x86 every
+// variant is compiled through a target attribute and one is chosen by CPUID at startup, so a
+// single binary uses AVX-512 or AVX2 where the CPU has it. Other compilers get SSE on x64.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_DISPATCH 1
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_DISPATCH 0
+#define SIMD_TARGET(isa)
+#endif
+
+#if SIMD_DISPATCH || defined(_M_X64) || defined(__SSE2__)
+#define SIMD_SSE 1
+#else
+#define SIMD_SSE 0
+#endif
+
+// Neighbor attributes of one particle for the vector force kernel, count padded to the vector
+// width with points outside the support. The kernel also lists the candidates closer than the
+// hard sphere contact distance, so the collision pass does not search neighbors again.
+struct ForceCandidates {
+    const float* x;
+    const float* y;
+    const float* vx;
+    const float* vy;
+    const float* pressure;
+    const float* density;
+    size_t count;
+    float contactSq;
+    int* contacts; // room for count indices
+    size_t contactCount;
+};
+
+// Plain float attribute arrays of a particle store, for the integrate kernel
+struct ParticleArrays {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    const float* fx;
+    const float* fy;
+    const float* density;
+    size_t count;
+};
+
+
+struct IntegrateParams {
+    float dt;
+    float maxVelocity;
+    float radius;
+    float damping;
+    float left, right, top, bottom;
+};
+
+// Sum of (h^2 - r^2)^3 over the points (xs[k], ys[k]) within the support around (x, y). The
+// vector variants turn r2 < h^2 into a lane mask that zeroes the lanes outside; count must be
+// a multiple of their width, with padding points placed far away.
+inline float poly6SumScalar(float x, float y, const float* xs, const float* ys, size_t count) {
+    float sum = 0.f;
+    for (size_t k = 0; k < count; k++) {
+        const float r2 = (x - xs[k]) * (x - xs[k]) + (y - ys[k]) * (y - ys[k]);
+        if (r2 < KERNEL_SUPPORT_SQ) {
+            const float q = KERNEL_SUPPORT_SQ - r2;
+            sum += q * q * q;
+        }
+    }
+    return sum;
+}
+
+// Spiky pressure gradient and viscosity Laplacian forces on particle p. Candidates outside the
+// support or at r ~ 0, which includes p itself, do not contribute.
+inline sf::Vector2f spikyViscosityForceScalar(const Particle& p, ForceCandidates& c, float mass, float viscosity) {
+    sf::Vector2f force(0.f, 0.f);
+    c.contactCount = 0;
+    for (size_t k = 0; k < c.count; k++) {
+        const sf::Vector2f diff(p.position.x - c.x[k], p.position.y - c.y[k]);
+        const float r2 = diff.x * diff.x + diff.y * diff.y;
+        const float r = std::sqrt(r2);
+        if (r2 < c.contactSq && r > 0.0001f) {
+            c.contacts[c.contactCount++] = static_cast<int>(k);
+        }
+        if (r < KERNEL_SUPPORT && r > 0.0001f) {
+            const float hr = KERNEL_SUPPORT - r;
+            const float pressureTerm = 0.5f * mass * SpikyGradientKernel::SCALE * (p.pressure + c.pressure[k]) * hr * hr /
+                                       (p.density * c.density[k] * r);
+            const float viscosityTerm = mass * viscosity * ViscosityLaplacianKernel::SCALE * hr / c.density[k];
+            force += diff * pressureTerm + sf::Vector2f(c.vx[k] - p.velocity.x, c.vy[k] - p.velocity.y) * viscosityTerm;
+        }
+    }
+    return force;
+}
+
+// Velocity from force, speed clamp, position and border bounce for particles begin to end,
+// the same arithmetic as BasicFluidSimulator::integrate
+inline void integrateScalarRange(const ParticleArrays& a, const IntegrateParams& params, size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+        float vx = a.vx[k] + params.dt * a.fx[k] / a.density[k];
+        float vy = a.vy[k] + params.dt * a.fy[k] / a.density[k];
+        const float speed = std::sqrt(vx * vx + vy * vy);
+        if (speed > params.maxVelocity) {
+            const float scale = params.maxVelocity / speed;
+            vx *= scale;
+            vy *= scale;
+        }
+        float x = a.x[k] + params.dt * vx;
+        float y = a.y[k] + params.dt * vy;
+        if (x + params.radius < params.left) { x = params.left - params.radius; vx *= -params.damping; }
+        if (x + params.radius > params.right) { x = params.right - params.radius; vx *= -params.damping; }
+        if (y + params.radius < params.top) { y = params.top - params.radius; vy *= -params.damping; }
+        if (y + params.radius > params.bottom) { y = params.bottom - params.radius; vy *= -params.damping; }
+        a.vx[k] = vx;
+        a.vy[k] = vy;
+        a.x[k] = x;
+        a.y[k] = y;
+    }
+}
+
+inline void integrateScalar(const ParticleArrays& arrays, const IntegrateParams& params) {
+    integrateScalarRange(arrays, params, 0, arrays.count);
+}
+
+// Bulk binary16 conversions of CompactParticleStore. Paths from AVX2 on convert eight values per
+// F16C instruction.
+inline void halvesToFloatsScalar(const std::uint16_t* halves, float* values, size_t count) {
+    for (size_t k = 0; k < count; k++) values[k] = halfToFloat(halves[k]);
+}
+
+inline void floatsToHalvesScalar(const float* values, std::uint16_t* halves, size_t count) {
+    for (size_t k = 0; k < count; k++) halves[k] = floatToHalf(values[k]);
+}
+
+#if SIMD_SSE
+SIMD_TARGET("sse2") inline float horizontalSum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+// mask ? b : a without SSE4.1 blends
+SIMD_TARGET("sse2") inline __m128 selectLanes(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+SIMD_TARGET("sse2") inline float poly6SumSse(float x, float y, const float* xs, const float* ys, size_t count) {
+    const __m128 px = _mm_set1_ps(x);
+    const __m128 py = _mm_set1_ps(y);
+    const __m128 supportSq = _mm_set1_ps(KERNEL_SUPPORT_SQ);
+    __m128 sum = _mm_setzero_ps();
+    for (size_t k = 0; k < count; k += 4) {
+        const __m128 dx = _mm_sub_ps(px, _mm_load_ps(xs + k));
+        const __m128 dy = _mm_sub_ps(py, _mm_load_ps(ys + k));
+        const __m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 inside = _mm_cmplt_ps(r2, supportSq);
+        const __m128 q = _mm_and_ps(inside, _mm_sub_ps(supportSq, r2));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(q, q), q));
+    }
+    return horizontalSum(sum);
+}
+
+SIMD_TARGET("sse2") inline sf::Vector2f spikyViscosityForceSse(const Particle& p, ForceCandidates& c, float mass, float viscosity) {
+    const __m128 px = _mm_set1_ps(p.position.x);
+    const __m128 py = _mm_set1_ps(p.position.y);
+    const __m128 pvx = _mm_set1_ps(p.velocity.x);
+    const __m128 pvy = _mm_set1_ps(p.velocity.y);
+    const __m128 pressureI = _mm_set1_ps(p.pressure);
+    const __m128 densityI = _mm_set1_ps(p.density);
+    const __m128 support = _mm_set1_ps(KERNEL_SUPPORT);
+    const __m128 minR = _mm_set1_ps(0.0001f);
+    const __m128 pressureScale = _mm_set1_ps(0.5f * mass * SpikyGradientKernel::SCALE);
+    const __m128 viscosityScale = _mm_set1_ps(mass * viscosity * ViscosityLaplacianKernel::SCALE);
+    const __m128 contactSq = _mm_set1_ps(c.contactSq);
+    __m128 fx = _mm_setzero_ps();
+    __m128 fy = _mm_setzero_ps();
+    c.contactCount = 0;
+    for (size_t k = 0; k < c.count; k += 4) {
+        const __m128 dx = _mm_sub_ps(px, _mm_load_ps(c.x + k));
+        const __m128 dy = _mm_sub_ps(py, _mm_load_ps(c.y + k));
+        const __m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 r = _mm_sqrt_ps(r2);
+        const __m128 nonzero = _mm_cmpgt_ps(r, minR);
+        const __m128 inside = _mm_and_ps(_mm_cmplt_ps(r, support), nonzero);
+
+        const int contact = _mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(r2, contactSq), nonzero));
+        for (int lane = 0; contact != 0 && lane < 4; lane++) {
+            if (contact & (1 << lane)) c.contacts[c.contactCount++] = static_cast<int>(k) + lane;
+        }
+        const __m128 hr = _mm_sub_ps(support, r);
+        const __m128 densityJ = _mm_load_ps(c.density + k);
+
+        // (p_i + p_j) / (2 rho_i rho_j) * m * dW/dr / r, and m * mu * lap W / rho_j, sharing one
+        // division by rho_i rho_j r
+        const __m128 inverse = _mm_div_ps(_mm_set1_ps(1.f), _mm_mul_ps(_mm_mul_ps(densityI, densityJ), r));
+        const __m128 pressureTerm = _mm_mul_ps(
+            _mm_mul_ps(_mm_mul_ps(pressureScale, _mm_add_ps(pressureI, _mm_load_ps(c.pressure + k))), _mm_mul_ps(hr, hr)),
+            inverse);
+        const __m128 viscosityTerm = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(viscosityScale, hr), _mm_mul_ps(densityI, r)), inverse);
+
+        const __m128 dvx = _mm_sub_ps(_mm_load_ps(c.vx + k), pvx);
+        const __m128 dvy = _mm_sub_ps(_mm_load_ps(c.vy + k), pvy);
+        fx = _mm_add_ps(fx, _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(dx, pressureTerm), _mm_mul_ps(dvx, viscosityTerm))));
+        fy = _mm_add_ps(fy, _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(dy, pressureTerm), _mm_mul_ps(dvy, viscosityTerm))));
+    }
+    return sf::Vector2f(horizontalSum(fx), horizontalSum(fy));
+}
+
+SIMD_TARGET("sse2") inline void integrateSse(const ParticleArrays& a, const IntegrateParams& params) {
+    const __m128 dt = _mm_set1_ps(params.dt);
+    const __m128 maxVelocity = _mm_set1_ps(params.maxVelocity);
+    const __m128 radius = _mm_set1_ps(params.radius);
+    const __m128 bounce = _mm_set1_ps(-params.damping);
+    const __m128 left = _mm_set1_ps(params.left), right = _mm_set1_ps(params.right);
+    const __m128 top = _mm_set1_ps(params.top), bottom = _mm_set1_ps(params.bottom);
+    const size_t vectorEnd = a.count / 4 * 4;
+    for (size_t k = 0; k < vectorEnd; k += 4) {
+        const __m128 density = _mm_load_ps(a.density + k);
+        __m128 vx = _mm_add_ps(_mm_load_ps(a.vx + k), _mm_div_ps(_mm_mul_ps(dt, _mm_load_ps(a.fx + k)), density));
+        __m128 vy = _mm_add_ps(_mm_load_ps(a.vy + k), _mm_div_ps(_mm_mul_ps(dt, _mm_load_ps(a.fy + k)), density));
+        const __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+        const __m128 tooFast = _mm_cmpgt_ps(speed, maxVelocity);
+        const __m128 scale = _mm_div_ps(maxVelocity, speed);
+        vx = selectLanes(tooFast, vx, _mm_mul_ps(vx, scale));
+        vy = selectLanes(tooFast, vy, _mm_mul_ps(vy, scale));
+
+        __m128 x = _mm_add_ps(_mm_load_ps(a.x + k), _mm_mul_ps(dt, vx));
+        __m128 y = _mm_add_ps(_mm_load_ps(a.y + k), _mm_mul_ps(dt, vy));
+        __m128 hit = _mm_cmplt_ps(_mm_add_ps(x, radius), left);
+        x = selectLanes(hit, x, _mm_sub_ps(left, radius));
+        vx = selectLanes(hit, vx, _mm_mul_ps(vx, bounce));
+        hit = _mm_cmpgt_ps(_mm_add_ps(x, radius), right);
+        x = selectLanes(hit, x, _mm_sub_ps(right, radius));
+        vx = selectLanes(hit, vx, _mm_mul_ps(vx, bounce));
+        hit = _mm_cmplt_ps(_mm_add_ps(y, radius), top);
+        y = selectLanes(hit, y, _mm_sub_ps(top, radius));
+        vy = selectLanes(hit, vy, _mm_mul_ps(vy, bounce));
+        hit = _mm_cmpgt_ps(_mm_add_ps(y, radius), bottom);
+        y = selectLanes(hit, y, _mm_sub_ps(bottom, radius));
+        vy = selectLanes(hit, vy, _mm_mul_ps(vy, bounce));
+
+        _mm_store_ps(a.vx + k, vx);
+        _mm_store_ps(a.vy + k, vy);
+        _mm_store_ps(a.x + k, x);
+        _mm_store_ps(a.y + k, y);
+    }
+    integrateScalarRange(a, params, vectorEnd, a.count);
+}
+#endif
+
+#if SIMD_DISPATCH
+SIMD_TARGET("avx2,fma") inline float horizontalSum(__m256 v) {
+    return horizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+SIMD_TARGET("avx2,fma") inline float poly6SumAvx2(float x, float y, const float* xs, const float* ys, size_t count) {
+    const __m256 px = _mm256_set1_ps(x);
+    const __m256 py = _mm256_set1_ps(y);
+    const __m256 supportSq = _mm256_set1_ps(KERNEL_SUPPORT_SQ);
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t k = 0; k < count; k += 8) {
+        const __m256 dx = _mm256_sub_ps(px, _mm256_load_ps(xs + k));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_load_ps(ys + k));
+        const __m256 r2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 inside = _mm256_cmp_ps(r2, supportSq, _CMP_LT_OQ);
+        const __m256 q = _mm256_and_ps(inside, _mm256_sub_ps(supportSq, r2));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(q, q), q));
+    }
+    return horizontalSum(sum);
+}
+
+SIMD_TARGET("avx2,fma") inline sf::Vector2f spikyViscosityForceAvx2(const Particle& p, ForceCandidates& c, float mass, float viscosity) {
+    const __m256 px = _mm256_set1_ps(p.position.x);
+    const __m256 py = _mm256_set1_ps(p.position.y);
+    const __m256 pvx = _mm256_set1_ps(p.velocity.x);
+    const __m256 pvy = _mm256_set1_ps(p.velocity.y);
+    const __m256 pressureI = _mm256_set1_ps(p.pressure);
+    const __m256 densityI = _mm256_set1_ps(p.density);
+    const __m256 support = _mm256_set1_ps(KERNEL_SUPPORT);
+    const __m256 minR = _mm256_set1_ps(0.0001f);
+    const __m256 pressureScale = _mm256_set1_ps(0.5f * mass * SpikyGradientKernel::SCALE);
+    const __m256 viscosityScale = _mm256_set1_ps(mass * viscosity * ViscosityLaplacianKernel::SCALE);
+    const __m256 contactSq = _mm256_set1_ps(c.contactSq);
+    __m256 fx = _mm256_setzero_ps();
+    __m256 fy = _mm256_setzero_ps();
+    c.contactCount = 0;
+    for (size_t k = 0; k < c.count; k += 8) {
+        const __m256 dx = _mm256_sub_ps(px, _mm256_load_ps(c.x + k));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_load_ps(c.y + k));
+        const __m256 r2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 r = _mm256_sqrt_ps(r2);
+        const __m256 nonzero = _mm256_cmp_ps(r, minR, _CMP_GT_OQ);
+        const __m256 inside = _mm256_and_ps(_mm256_cmp_ps(r, support, _CMP_LT_OQ), nonzero);
+
+        const int contact = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(r2, contactSq, _CMP_LT_OQ), nonzero));
+        for (int lane = 0; contact != 0 && lane < 8; lane++) {
+            if (contact & (1 << lane)) c.contacts[c.contactCount++] = static_cast<int>(k) + lane;
+        }
+        const __m256 hr = _mm256_sub_ps(support, r);
+        const __m256 densityJ = _mm256_load_ps(c.density + k);
+
+        const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(_mm256_mul_ps(densityI, densityJ), r));
+        const __m256 pressureTerm = _mm256_mul_ps(
+            _mm256_mul_ps(_mm256_mul_ps(pressureScale, _mm256_add_ps(pressureI, _mm256_load_ps(c.pressure + k))),
+                          _mm256_mul_ps(hr, hr)),
+            inverse);
+        const __m256 viscosityTerm = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(viscosityScale, hr), _mm256_mul_ps(densityI, r)),
+                                                   inverse);
+
+        const __m256 dvx = _mm256_sub_ps(_mm256_load_ps(c.vx + k), pvx);
+        const __m256 dvy = _mm256_sub_ps(_mm256_load_ps(c.vy + k), pvy);
+        fx = _mm256_add_ps(fx, _mm256_and_ps(inside,
+            _mm256_add_ps(_mm256_mul_ps(dx, pressureTerm), _mm256_mul_ps(dvx, viscosityTerm))));
+        fy = _mm256_add_ps(fy, _mm256_and_ps(inside,
+            _mm256_add_ps(_mm256_mul_ps(dy, pressureTerm), _mm256_mul_ps(dvy, viscosityTerm))));
+    }
+    return sf::Vector2f(horizontalSum(fx), horizontalSum(fy));
+}
+
+SIMD_TARGET("avx2,fma") inline void integrateAvx2(const ParticleArrays& a, const IntegrateParams& params) {
+    const __m256 dt = _mm256_set1_ps(params.dt);
+    const __m256 maxVelocity = _mm256_set1_ps(params.maxVelocity);
+    const __m256 radius = _mm256_set1_ps(params.radius);
+    const __m256 bounce = _mm256_set1_ps(-params.damping);
+    const __m256 left = _mm256_set1_ps(params.left), right = _mm256_set1_ps(params.right);
+    const __m256 top = _mm256_set1_ps(params.top), bottom = _mm256_set1_ps(params.bottom);
+    const size_t vectorEnd = a.count / 8 * 8;
+    for (size_t k = 0; k < vectorEnd; k += 8) {
+        const __m256 density = _mm256_load_ps(a.density + k);
+        __m256 vx = _mm256_add_ps(_mm256_load_ps(a.vx + k), _mm256_div_ps(_mm256_mul_ps(dt, _mm256_load_ps(a.fx + k)), density));
+        __m256 vy = _mm256_add_ps(_mm256_load_ps(a.vy + k), _mm256_div_ps(_mm256_mul_ps(dt, _mm256_load_ps(a.fy + k)), density));
+        const __m256 speed = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)));
+        const __m256 tooFast = _mm256_cmp_ps(speed, maxVelocity, _CMP_GT_OQ);
+        const __m256 scale = _mm256_div_ps(maxVelocity, speed);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, scale), tooFast);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, scale), tooFast);
+
+        __m256 x = _mm256_add_ps(_mm256_load_ps(a.x + k), _mm256_mul_ps(dt, vx));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(a.y + k), _mm256_mul_ps(dt, vy));
+        __m256 hit = _mm256_cmp_ps(_mm256_add_ps(x, radius), left, _CMP_LT_OQ);
+        x = _mm256_blendv_ps(x, _mm256_sub_ps(left, radius), hit);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, bounce), hit);
+        hit = _mm256_cmp_ps(_mm256_add_ps(x, radius), right, _CMP_GT_OQ);
+        x = _mm256_blendv_ps(x, _mm256_sub_ps(right, radius), hit);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, bounce), hit);
+        hit = _mm256_cmp_ps(_mm256_add_ps(y, radius), top, _CMP_LT_OQ);
+        y = _mm256_blendv_ps(y, _mm256_sub_ps(top, radius), hit);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), hit);
+        hit = _mm256_cmp_ps(_mm256_add_ps(y, radius), bottom, _CMP_GT_OQ);
+        y = _mm256_blendv_ps(y, _mm256_sub_ps(bottom, radius), hit);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), hit);
+
+        _mm256_store_ps(a.vx + k, vx);
+        _mm256_store_ps(a.vy + k, vy);
+        _mm256_store_ps(a.x + k, x);
+        _mm256_store_ps(a.y + k, y);
+    }
+    integrateScalarRange(a, params, vectorEnd, a.count);
+}
+
+SIMD_TARGET("avx2,f16c") inline void halvesToFloatsF16c(const std::uint16_t* halves, float* values, size_t count) {
+    const size_t vectorEnd = count / 8 * 8;
+    for (size_t k = 0; k < vectorEnd; k += 8) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + k));
+        _mm256_storeu_ps(values + k, _mm256_cvtph_ps(packed));
+    }
+    halvesToFloatsScalar(halves + vectorEnd, values + vectorEnd, count - vectorEnd);
+}
+
+SIMD_TARGET("avx2,f16c") inline void floatsToHalvesF16c(const float* values, std::uint16_t* halves, size_t count) {
+    const size_t vectorEnd = count / 8 * 8;
+    for (size_t k = 0; k < vectorEnd; k += 8) {
+        const __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(values + k), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(halves + k), packed);
+    }
+    floatsToHalvesScalar(values + vectorEnd, halves + vectorEnd, count - vectorEnd);
+}
+
+// AVX-512 masks replace the and/blend steps. Without -mavx512f GCC warns about the undefined
+// pass-through operand some of these intrinsics use internally.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+SIMD_TARGET("avx512f") inline float poly6SumAvx512(float x, float y, const float* xs, const float* ys, size_t count) {
+    const __m512 px = _mm512_set1_ps(x);
+    const __m512 py = _mm512_set1_ps(y);
+    const __m512 supportSq = _mm512_set1_ps(KERNEL_SUPPORT_SQ);
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t k = 0; k < count; k += 16) {
+        const __m512 dx = _mm512_sub_ps(px, _mm512_load_ps(xs + k));
+        const __m512 dy = _mm512_sub_ps(py, _mm512_load_ps(ys + k));
+        const __m512 r2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        const __mmask16 inside = _mm512_cmp_ps_mask(r2, supportSq, _CMP_LT_OQ);
+        const __m512 q = _mm512_maskz_sub_ps(inside, supportSq, r2);
+        sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_mul_ps(q, q), q));
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+SIMD_TARGET("avx512f") inline sf::Vector2f spikyViscosityForceAvx512(const Particle& p, ForceCandidates& c, float mass, float viscosity) {
+    const __m512 px = _mm512_set1_ps(p.position.x);
+    const __m512 py = _mm512_set1_ps(p.position.y);
+    const __m512 pvx = _mm512_set1_ps(p.velocity.x);
+    const __m512 pvy = _mm512_set1_ps(p.velocity.y);
+    const __m512 pressureI = _mm512_set1_ps(p.pressure);
+    const __m512 densityI = _mm512_set1_ps(p.density);
+    const __m512 support = _mm512_set1_ps(KERNEL_SUPPORT);
+    const __m512 minR = _mm512_set1_ps(0.0001f);
+    const __m512 pressureScale = _mm512_set1_ps(0.5f * mass * SpikyGradientKernel::SCALE);
+    const __m512 viscosityScale = _mm512_set1_ps(mass * viscosity * ViscosityLaplacianKernel::SCALE);
+    const __m512 contactSq = _mm512_set1_ps(c.contactSq);
+    __m512 fx = _mm512_setzero_ps();
+    __m512 fy = _mm512_setzero_ps();
+    c.contactCount = 0;
+    for (size_t k = 0; k < c.count; k += 16) {
+        const __m512 dx = _mm512_sub_ps(px, _mm512_load_ps(c.x + k));
+        const __m512 dy = _mm512_sub_ps(py, _mm512_load_ps(c.y + k));
+        const __m512 r2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        const __m512 r = _mm512_sqrt_ps(r2);
+        const __mmask16 nonzero = _mm512_cmp_ps_mask(r, minR, _CMP_GT_OQ);
+        const __mmask16 inside = _mm512_mask_cmp_ps_mask(nonzero, r, support, _CMP_LT_OQ);
+
+        const unsigned contact = _mm512_mask_cmp_ps_mask(nonzero, r2, contactSq, _CMP_LT_OQ);
+        for (int lane = 0; (contact >> lane) != 0; lane++) {
+            if (contact & (1u << lane)) c.contacts[c.contactCount++] = static_cast<int>(k) + lane;
+        }
+        const __m512 hr = _mm512_sub_ps(support, r);
+        const __m512 densityJ = _mm512_load_ps(c.density + k);
+
+        const __m512 inverse = _mm512_div_ps(_mm512_set1_ps(1.f), _mm512_mul_ps(_mm512_mul_ps(densityI, densityJ), r));
+        const __m512 pressureTerm = _mm512_mul_ps(
+            _mm512_mul_ps(_mm512_mul_ps(pressureScale, _mm512_add_ps(pressureI, _mm512_load_ps(c.pressure + k))),
+                          _mm512_mul_ps(hr, hr)),
+            inverse);
+        const __m512 viscosityTerm = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(viscosityScale, hr), _mm512_mul_ps(densityI, r)),
+                                                   inverse);
+
+        const __m512 dvx = _mm512_sub_ps(_mm512_load_ps(c.vx + k), pvx);
+        const __m512 dvy = _mm512_sub_ps(_mm512_load_ps(c.vy + k), pvy);
+        fx = _mm512_mask_add_ps(fx, inside, fx,
+            _mm512_add_ps(_mm512_mul_ps(dx, pressureTerm), _mm512_mul_ps(dvx, viscosityTerm)));
+        fy = _mm512_mask_add_ps(fy, inside, fy,
+            _mm512_add_ps(_mm512_mul_ps(dy, pressureTerm), _mm512_mul_ps(dvy, viscosityTerm)));
+    }
+    return sf::Vector2f(_mm512_reduce_add_ps(fx), _mm512_reduce_add_ps(fy));
+}
+
+SIMD_TARGET("avx512f") inline void integrateAvx512(const ParticleArrays& a, const IntegrateParams& params) {
+    const __m512 dt = _mm512_set1_ps(params.dt);
+    const __m512 maxVelocity = _mm512_set1_ps(params.maxVelocity);
+    const __m512 radius = _mm512_set1_ps(params.radius);
+    const __m512 bounce = _mm512_set1_ps(-params.damping);
+    const __m512 left = _mm512_set1_ps(params.left), right = _mm512_set1_ps(params.right);
+    const __m512 top = _mm512_set1_ps(params.top), bottom = _mm512_set1_ps(params.bottom);
+    const size_t vectorEnd = a.count / 16 * 16;
+    for (size_t k = 0; k < vectorEnd; k += 16) {
+        const __m512 density = _mm512_load_ps(a.density + k);
+        __m512 vx = _mm512_add_ps(_mm512_load_ps(a.vx + k), _mm512_div_ps(_mm512_mul_ps(dt, _mm512_load_ps(a.fx + k)), density));
+        __m512 vy = _mm512_add_ps(_mm512_load_ps(a.vy + k), _mm512_div_ps(_mm512_mul_ps(dt, _mm512_load_ps(a.fy + k)), density));
+        const __m512 speed = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy)));
+        const __mmask16 tooFast = _mm512_cmp_ps_mask(speed, maxVelocity, _CMP_GT_OQ);
+        const __m512 scale = _mm512_div_ps(maxVelocity, speed);
+        vx = _mm512_mask_mul_ps(vx, tooFast, vx, scale);
+        vy = _mm512_mask_mul_ps(vy, tooFast, vy, scale);
+
+        __m512 x = _mm512_add_ps(_mm512_load_ps(a.x + k), _mm512_mul_ps(dt, vx));
+        __m512 y = _mm512_add_ps(_mm512_load_ps(a.y + k), _mm512_mul_ps(dt, vy));
+        __mmask16 hit = _mm512_cmp_ps_mask(_mm512_add_ps(x, radius), left, _CMP_LT_OQ);
+        x = _mm512_mask_sub_ps(x, hit, left, radius);
+        vx = _mm512_mask_mul_ps(vx, hit, vx, bounce);
+        hit = _mm512_cmp_ps_mask(_mm512_add_ps(x, radius), right, _CMP_GT_OQ);
+        x = _mm512_mask_sub_ps(x, hit, right, radius);
+        vx = _mm512_mask_mul_ps(vx, hit, vx, bounce);
+        hit = _mm512_cmp_ps_mask(_mm512_add_ps(y, radius), top, _CMP_LT_OQ);
+        y = _mm512_mask_sub_ps(y, hit, top, radius);
+        vy = _mm512_mask_mul_ps(vy, hit, vy, bounce);
+        hit = _mm512_cmp_ps_mask(_mm512_add_ps(y, radius), bottom, _CMP_GT_OQ);
+        y = _mm512_mask_sub_ps(y, hit, bottom, radius);
+        vy = _mm512_mask_mul_ps(vy, hit, vy, bounce);
+
+        _mm512_store_ps(a.vx + k, vx);
+        _mm512_store_ps(a.vy + k, vy);
+        _mm512_store_ps(a.x + k, x);
+        _mm512_store_ps(a.y + k, y);
+    }
+    integrateScalarRange(a, params, vectorEnd, a.count);
+}
+#pragma GCC diagnostic pop
+#endif
+
+enum class SimdPath {
+    SCALAR,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+// One instruction set's kernels. width is the number of candidates per instruction, which the
+// candidate arrays are padded to.
+struct SimdKernels {
+    SimdPath path;
+    const char* name;
+    int width;
+    float (*poly6Sum)(float x, float y, const float* xs, const float* ys, size_t count);
+    sf::Vector2f (*spikyViscosityForce)(const Particle& p, ForceCandidates& c, float mass, float viscosity);
+    void (*integrate)(const ParticleArrays& arrays, const IntegrateParams& params);
+    void (*halvesToFloats)(const std::uint16_t* halves, float* values, size_t count);
+    void (*floatsToHalves)(const float* values, std::uint16_t* halves, size_t count);
+};
+
+inline SimdKernels simdKernelsFor(SimdPath path) {
+    switch (path) {
+#if SIMD_DISPATCH
+        case SimdPath::AVX512:
+            return {SimdPath::AVX512, "AVX-512", 16, poly6SumAvx512, spikyViscosityForceAvx512, integrateAvx512,
+                    halvesToFloatsF16c, floatsToHalvesF16c};
+        case SimdPath::AVX2:
+            return {SimdPath::AVX2, "AVX2", 8, poly6SumAvx2, spikyViscosityForceAvx2, integrateAvx2,
+                    halvesToFloatsF16c, floatsToHalvesF16c};
+#endif
+#if SIMD_SSE
+        case SimdPath::SSE:
+            return {SimdPath::SSE, "SSE", 4, poly6SumSse, spikyViscosityForceSse, integrateSse,
+                    halvesToFloatsScalar, floatsToHalvesScalar};
+#endif
+        default:
+            return {SimdPath::SCALAR, "scalar", 1, poly6SumScalar, spikyViscosityForceScalar, integrateScalar,
+                    halvesToFloatsScalar, floatsToHalvesScalar};
+    }
+}
+
+// Whether this CPU and OS can run a path's kernels, and this build has them
+inline bool simdPathSupported(SimdPath path) {
+    switch (path) {
+        case SimdPath::SCALAR:
+            return true;
+#if SIMD_DISPATCH
+        case SimdPath::SSE:
+            return __builtin_cpu_supports("sse2");
+        case SimdPath::AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+        case SimdPath::AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("f16c");
+#else
+        case SimdPath::SSE:
+            return SIMD_SSE != 0;
+#endif
+        default:
+            return false;
+    }
+}
+
+// The widest supported path. FLUID_SIMD=scalar, sse, avx2 or avx512 overrides it, for example
+// to compare paths on one machine; a path the CPU cannot run falls back to the widest one.
+inline SimdPath selectSimdPath() {
+    SimdPath best = SimdPath::SCALAR;
+    for (SimdPath path : {SimdPath::SSE, SimdPath::AVX2, SimdPath::AVX512}) {
+        if (simdPathSupported(path)) best = path;
+    }
+
+    const char* requested = std::getenv("FLUID_SIMD");
+    if (requested == nullptr || requested[0] == '\0') {
+        return best;
+    }
+    const char* names[] = {"scalar", "sse", "avx2", "avx512"};
+    const SimdPath paths[] = {SimdPath::SCALAR, SimdPath::SSE, SimdPath::AVX2, SimdPath::AVX512};
+    for (int p = 0; p < 4; p++) {
+        if (std::strcmp(requested, names[p]) != 0) continue;
+        if (simdPathSupported(paths[p])) return paths[p];
+        std::cerr << "FLUID_SIMD=" << requested << " is not supported on this CPU, using "
+                  << simdKernelsFor(best).name << "\n";
+        return best;
+    }
+    std::cerr << "FLUID_SIMD=" << requested << " is unknown, expected scalar, sse, avx2 or avx512\n";
+    return best;
+}
+
+// Kernels chosen once at startup
+inline const SimdKernels& simdKernels() {
+    static const SimdKernels kernels = simdKernelsFor(selectSimdPath());
+    return kernels;
+}
+
+// The integrate kernel reaches the SoA layout's float arrays directly and the mixed precision
+// layout through blocks converted to float and back; the interleaved stores integrate through
+// their accessors
+template <typename Store>
+struct HasVectorIntegrate : std::false_type {};
+
+template <>
+struct HasVectorIntegrate<SoAParticleStore> : std::true_type {};
+
+template <>
+struct HasVectorIntegrate<CompactParticleStore> : std::true_type {};
+
+template <typename Store>
+void integrateVector(Store&, const SimdKernels&, const IntegrateParams&) {}
+
+// The mixed precision layout gathers the halves of the force candidates and converts them in
+// bulk, instead of one accessor call per attribute and neighbor
+template <typename Store>
+struct HasPackedAttributes : std::false_type {};
+
+template <>
+struct HasPackedAttributes<CompactParticleStore> : std::true_type {};
+
+template <typename Store>
+void gatherPackedCandidates(const Store&, const SimdKernels&, const int*, size_t, std::uint16_t*,
+                            float*, float*, float*, float*) {}
+
+inline void gatherPackedCandidates(const CompactParticleStore& store, const SimdKernels& simd, const int* ids,
+                                   size_t count, std::uint16_t* halves, float* vx, float* vy, float* pressure,
+                                   float* density) {
+    auto convert = [&](const std::uint16_t* source, float* values) {
+        for (size_t k = 0; k < count; k++) halves[k] = source[ids[k]];
+        simd.halvesToFloats(halves, values, count);
+    };
+    convert(store.vxData(), vx);
+    convert(store.vyData(), vy);
+    convert(store.densityData(), density);
+    convert(store.pressureData(), pressure);
+    for (size_t k = 0; k < count; k++) pressure[k] *= PRESSURE_HALF_SCALE;
+}
+
+inline void integrateVector(SoAParticleStore& store, const SimdKernels& simd, const IntegrateParams& params) {
+    ParticleArrays arrays;
+    arrays.x = store.xData();
+    arrays.y = store.yData();
+    arrays.vx = store.vxData();
+    arrays.vy = store.vyData();
+    arrays.fx = store.fxData();
+    arrays.fy = store.fyData();
+    arrays.density = store.densityData();
+    arrays.count = store.size();
+    simd.integrate(arrays, params);
+}
+
+inline void integrateVector(CompactParticleStore& store, const SimdKernels& simd, const IntegrateParams& params) {
+    const size_t BLOCK = 256;
+    alignas(64) float x[BLOCK], y[BLOCK], vx[BLOCK], vy[BLOCK], density[BLOCK];
+    ParticleArrays arrays = {x, y, vx, vy, nullptr, nullptr, density, 0};
+    for (size_t begin = 0; begin < store.size(); begin += BLOCK) {
+        const size_t count = std::min(BLOCK, store.size() - begin);
+        std::int32_t* xs = store.xData() + begin;
+        std::int32_t* ys = store.yData() + begin;
+        for (size_t k = 0; k < count; k++) {
+            x[k] = fixedToFloat(xs[k]);
+            y[k] = fixedToFloat(ys[k]);
+        }
+        simd.halvesToFloats(store.vxData() + begin, vx, count);
+        simd.halvesToFloats(store.vyData() + begin, vy, count);
+        simd.halvesToFloats(store.densityData() + begin, density, count);
+
+        // Blocks start at multiples of 256, so the force arrays keep their alignment
+        arrays.fx = store.fxData() + begin;
+        arrays.fy = store.fyData() + begin;
+        arrays.count = count;
+        simd.integrate(arrays, params);
+
+        for (size_t k = 0; k < count; k++) {
+            xs[k] = floatToFixed(x[k]);
+            ys[k] = floatToFixed(y[k]);
+        }
+        simd.floatsToHalves(vx, store.vxData() + begin, count);
+        simd.floatsToHalves(vy, store.vyData() + begin, count);
+    }
+}
+
+// Kernels of the density, pressure gradient and viscosity terms
+template <typename DensityKernel, typename GradientKernel, typename ViscosityKernel = ViscosityLaplacianKernel>
+struct SphKernels {
+    typedef DensityKernel Density;
+    typedef GradientKernel Gradient;
+    typedef ViscosityKernel Viscosity;
+};
+
+typedef SphKernels<Poly6Kernel, SpikyGradientKernel> MullerKernels;
+typedef SphKernels<CubicSplineKernel, CubicSplineKernel> CubicSplineKernels;
+typedef SphKernels<WendlandC2Kernel, WendlandC2Kernel> WendlandKernels;
+
+// Kernels of FluidSimulator, chosen at compile time: 0 Poly6 / Spiky / viscosity Laplacian,
+// 1 cubic spline, 2 Wendland C2
+#ifndef SPH_KERNELS
+#define SPH_KERNELS 0
+#endif
+
+#if SPH_KERNELS == 1
+typedef CubicSplineKernels SimulationKernels;
+#elif SPH_KERNELS == 2
+typedef WendlandKernels SimulationKernels;
+#else
+typedef MullerKernels SimulationKernels;
+#endif
+
+enum class KernelEvaluation {
+    CLOSED_FORM, // the kernel polynomials, coefficients folded for KERNEL_SUPPORT at compile time
+    TABLE        // KernelTable lookups, for any smoothing length
+};
+
+// Density, gradient and viscosity kernels of a SphKernels set sampled on [0, h] and interpolated
+// linearly, so a lookup costs the same for every kernel and needs no sqrt or pow. Values are
+// indexed by q2 = r^2 / h^2, which the density pass has without a sqrt. Gradients and Laplacians
+// are indexed by q = r / h, which the force pass computes anyway: their odd powers of q turn
+// into a square root over q2 that linear steps follow poorly near r = 0.
+// The samples rescale the closed forms from KERNEL_SUPPORT to the support h while keeping each
+// kernel's integral, and with it the rest density: with s = KERNEL_SUPPORT / h,
+// W_h(r) = s^2 W(s r), W_h'(r) = s^3 W'(s r) and lap W_h(r) = s^4 lap W(s r).
+class KernelTable {
+private:
+    static constexpr int INTERVALS = 1024;
+
+    float support = 0.f;
+    float valueScale = 0.f;  // INTERVALS / h^2
+    float radiusScale = 0.f; // INTERVALS / h
+    AlignedFloats values;    // INTERVALS + 2 samples, the last pads a lookup that rounds up to h
+    AlignedFloats gradients;
+    AlignedFloats laplacians;
+
+    static float lookup(const AlignedFloats& samples, float position) {
+        const int k = static_cast<int>(position);
+        const float t = position - static_cast<float>(k);
+        return samples[k] + t * (samples[k + 1] - samples[k]);
+    }
+
+public:
+    template <typename Kernels>
+    void build(float h) {
+        const float s = KERNEL_SUPPORT / h;
+        values.assign(INTERVALS + 2, 0.f);
+        gradients.assign(INTERVALS + 2, 0.f);
+        laplacians.assign(INTERVALS + 2, 0.f);
+        for (int k = 0; k < INTERVALS; k++) {
+            const float position = static_cast<float>(k) / INTERVALS; // q2 of the values, q of the others
+            const float r = position * KERNEL_SUPPORT;
+            values[k] = s * s * Kernels::Density::value(position * KERNEL_SUPPORT_SQ);
+            gradients[k] = s * s * s * Kernels::Gradient::gradient(r);
+            laplacians[k] = s * s * s * s * Kernels::Viscosity::laplacian(r);
+        }
+        support = h;
+        valueScale = INTERVALS / (h * h);
+        radiusScale = INTERVALS / h;
+    }
+
+    // Support the table was built for, 0 before the first build
+    float getSupport() const { return support; }
+
+    // r2 below h^2 and r below h; the callers test the support before the lookup
+    float value(float r2) const { return lookup(values, r2 * valueScale); }
+    float gradient(float r) const { return lookup(gradients, r * radiusScale); }
+    float laplacian(float r) const { return lookup(laplacians, r * radiusScale); }
+
+    size_t getMemoryBytes() const {
+        return (values.size() + gradients.size() + laplacians.size()) * sizeof(float);
+    }
+};
+
+// SPH simulation over particles stored in a Store layout and evaluated with a set of SphKernels,
+// FluidSimulator uses the compile-time defaults
+template <typename Store, typename Kernels = MullerKernels>
+class BasicFluidSimulator {
+private:
+    sf::Vector2f gravity;
+    sf::FloatRect bounds;
+    Store particles;
+
+    const float VISCOSITY = 7000.f;
+    const float REST_DENSITY = 1000.f;
+    const float GAS_CONSTANT = 100.f;
+
+    UniformGrid grid;
+    VerletLists verletLists;
+    SpatialHash spatialHash;
+    Quadtree quadtree;
+    std::vector<float> smoothingLengths; // per particle, 0 uses SMOOTHING_LENGTH
+    float maxSmoothingLength = 0.f; // largest per particle value set since the last removeAllParticles()
+    bool variableSmoothing = false; // some particle got its own smoothing length
+    std::vector<ParticleId> particleIds; // per slot
+    std::vector<int> idSlots; // per ID index, the slot holding that particle, -1 once it is removed
+    std::vector<ParticleId> idGenerations; // per ID index, the generation of its current ID
+    std::vector<ParticleId> freeIds; // ID indices of removed particles, handed out again first
+    std::vector<char> removedSlots; // scratch for removeParticles()
+    size_t particleCapacity = 0; // 0 grows the storage as needed
+    long stepCount = 0;
+    long lastReorderStep = -1; // the step of the last Morton reordering
+    long reorderCount = 0;
+    bool neighborsReady = false;    // structures match the current positions and indices
+    float preparedCutoff = 0.f;
+    NeighborSearch preparedSearch = NeighborSearch::BRUTE_FORCE; // backend the structures were built for
+    long verletBuildCount = 0;
+    long gridFullBuildCount = 0;
+
+    // Time spent in the density, force and integrate passes and the neighbor search since
+    // resetPassTimes(), and the Verlet list builds in that time
+    double densityPassMs = 0.0;
+    double forcePassMs = 0.0;
+    double integratePassMs = 0.0;
+    double searchPassMs = 0.0;
+    long timedSteps = 0;
+    long timedVerletBuilds = 0;
+
+    // Scratch buffers for the Morton reordering
+    RadixSorter radixSorter;
+    std::vector<unsigned int> sortKeys;
+    std::vector<int> sortOrder;
+    Store reordered;
+    std::vector<float> reorderedSmoothingLengths;
+    std::vector<ParticleId> reorderedIds;
+
+    // Render state, refilled from the particles every draw
+    static const int CIRCLE_SEGMENTS = 12;
+    sf::VertexArray particleVertices;
+
+    std::vector<NeighborPair, AlignedAllocator<NeighborPair>> pairList;
+    float crossCheckDensityError = 0.f;
+    float crossCheckVectorDensityError = 0.f;
+    float crossCheckVectorForceError = 0.f;
+    int crossCheckMissedPairs = 0;
+    // Neighbor attributes of the particle in the vector density and force passes
+    AlignedFloats pairDensities; // PAIR_ONCE and PAIR_LIST sums, stored once per particle
+    AlignedFloats pairPressures; // with pairDensities, a packed store's values for the pair force passes
+    AlignedFloats candidateXs, candidateYs;
+    AlignedFloats candidateVxs, candidateVys;
+    AlignedFloats candidatePressures, candidateDensities;
+    AlignedInts candidateIds, candidateContacts;
+    std::vector<std::uint16_t, AlignedAllocator<std::uint16_t>> candidateHalves; // packed stores only
+    std::vector<std::pair<int, int>> contacts; // overlapping pairs found by the vector force pass
+    KernelTable kernelTable;
+    bool tabulatedKernels = false; // this step evaluates the kernels through kernelTable
+public:
+    float SMOOTHING_LENGTH = KERNEL_SUPPORT; // values other than KERNEL_SUPPORT evaluate the kernels from tables
+    float PARTICLE_RADIUS = 5.f;
+    float DAMPING = 0.4f;
+    float MAX_VELOCITY = 300.f;
+    float PARTICLE_MASS = 5.0f;
+    float VERLET_SKIN = 4.f;
+    int REORDER_INTERVAL = 50; // steps between Morton reorderings of the particles, 0 disables
+    float REBIN_MAX_MOVED_SHARE = 0.25f; // INCREMENTAL_GRID sorts everything again above this share of moved particles
+    NeighborSearch neighborSearch = NeighborSearch::UNIFORM_GRID;
+    PairEvaluation pairEvaluation = PairEvaluation::GATHER;
+    bool crossCheck = false; // also run brute force each step and record the difference
+    bool compressNeighborLists = false; // VERLET_LIST stores 16-bit index offsets
+    bool vectorizedDensity = true; // GATHER density pass in SIMD registers, Poly6 density kernels only
+    bool vectorizedForces = true; // GATHER force pass in SIMD registers and collisions apart, Spiky and viscosity Laplacian only
+    SimdKernels simd = simdKernels(); // instruction set of the vector passes, chosen at startup
+    KernelEvaluation kernelEvaluation = KernelEvaluation::CLOSED_FORM;
+
+    BasicFluidSimulator(const sf::FloatRect& boundsRect, const sf::Vector2f& gravityVec = sf::Vector2f(0.f, 981.f))
+        : gravity(gravityVec), bounds(boundsRect) {}
+
+    // Moves the container walls, the next step bins the particles for the new area
+    void setBounds(const sf::FloatRect& boundsRect) {
+        bounds = boundsRect;
+        verletLists.invalidate();
+        grid.invalidate();
+        neighborsReady = false;
+    }
+
+    const sf::FloatRect& getBounds() const {
+        return bounds;
+    }
+
+    // Returns the new particle's ID, or INVALID_PARTICLE_ID when a fixed pool is full or the
+    // IDs run out. The ID of a removed particle never finds another particle.
+    ParticleId addParticle(const sf::Vector2f& pos) {
+        Particle p;
+        p.position = pos;
+        p.velocity = sf::Vector2f(0.f, 0.f);
+        p.force = sf::Vector2f(0.f, 0.f);
+
+        if (particleCapacity > 0 && particles.size() >= particleCapacity) {
+            return INVALID_PARTICLE_ID;
+        }
+
+        const ParticleId id = acquireId(particles.size());
+        if (id == INVALID_PARTICLE_ID) return INVALID_PARTICLE_ID;
+        particleIds.push_back(id);
+        particles.push_back(p);
+        smoothingLengths.push_back(0.f);
+        neighborsReady = false;
+        return id;
+    }
+
+    // Adds a columns x rows lattice with its first particle at origin, each coordinate jittered
+    // by up to +-jitter. Storage grows once and the positions are filled in parallel, particle k
+    // of the block drawing from random stream k of seed, so a seed reproduces the block exactly.
+    // Returns how many particles were added, fewer if a fixed pool runs full.
+    size_t spawnBlock(const sf::Vector2f& origin, int columns, int rows, float spacing, float jitter,
+                      std::uint32_t seed) {
+        if (columns <= 0 || rows <= 0) return 0;
+        return spawnLattice(origin, columns, static_cast<size_t>(columns) * rows, sf::Vector2f(spacing, spacing),
+                            jitter, seed);
+    }
+
+    // Spreads count particles over area on a square lattice, spacing chosen so they fill it
+    size_t spawnRegion(const sf::FloatRect& area, size_t count, float jitter, std::uint32_t seed) {
+        if (count == 0 || area.width <= 0.f || area.height <= 0.f) return 0;
+        const float spacing = std::sqrt(area.width * area.height / count);
+        const int columns = std::max(1, static_cast<int>(area.width / spacing));
+        const size_t rows = (count + columns - 1) / columns;
+        const float rowSpacing = std::min(spacing, area.height / rows);
+        return spawnLattice(sf::Vector2f(area.left + spacing * 0.5f, area.top + rowSpacing * 0.5f),
+                            columns, count, sf::Vector2f(spacing, rowSpacing), jitter, seed);
+    }
+
+    // Removes one particle in O(1) by moving the last particle into its slot, which changes
+    // that particle's slot but not its ID. Returns false for an unknown ID.
+    bool removeParticle(ParticleId id) {
+        const int slot = findParticle(id);
+        if (slot < 0) return false;
+
+        const size_t last = particles.size() - 1;
+        if (static_cast<size_t>(slot) != last) {
+            moveSlot(last, slot);
+        }
+        particles.resize(last);
+        smoothingLengths.pop_back();
+        particleIds.pop_back();
+        releaseId(id);
+        neighborsReady = false;
+        return true;
+    }
+
+    // Removes a batch of particles in one compaction pass that keeps the order, and with it
+    // the memory locality, of the remaining ones. Unknown IDs are skipped.
+    void removeParticles(const ParticleId* ids, size_t count) {
+        removedSlots.assign(particles.size(), 0);
+        size_t removed = 0;
+        for (size_t k = 0; k < count; k++) {
+            const int slot = findParticle(ids[k]);
+            if (slot < 0 || removedSlots[slot]) continue;
+            removedSlots[slot] = 1;
+            releaseId(ids[k]);
+            removed++;
+        }
+        if (removed == 0) return;
+
+        size_t kept = 0;
+        for (size_t slot = 0; slot < particles.size(); slot++) {
+            if (removedSlots[slot]) continue;
+            if (kept != slot) moveSlot(slot, kept);
+            kept++;
+        }
+        particles.resize(kept);
+        smoothingLengths.resize(kept);
+        particleIds.resize(kept);
+        neighborsReady = false;
+    }
+
+    // IDs from before the reset no longer find a particle
+    void removeAllParticles() {
+        for (ParticleId id : particleIds) {
+            releaseId(id);
+        }
+        particles.clear();
+        smoothingLengths.clear();
+        particleIds.clear();
+        maxSmoothingLength = 0.f;
+        variableSmoothing = false;
+        neighborsReady = false;
+    }
+
+    // Turns the particle storage into a fixed pool: memory for capacity particles is allocated
+    // once, so adding and removing particles afterwards does not touch the heap, and
+    // addParticle() returns INVALID_PARTICLE_ID while the pool is full. 0 removes the limit.
+    void setParticleCapacity(size_t capacity) {
+        particleCapacity = capacity;
+        particles.reserve(capacity);
+        reordered.reserve(capacity);
+        smoothingLengths.reserve(capacity);
+        reorderedSmoothingLengths.reserve(capacity);
+        pairDensities.reserve(capacity);
+        pairPressures.reserve(capacity);
+        particleIds.reserve(capacity);
+        reorderedIds.reserve(capacity);
+        idSlots.reserve(capacity);
+        idGenerations.reserve(capacity);
+        freeIds.reserve(capacity);
+        removedSlots.reserve(capacity);
+        sortKeys.reserve(capacity);
+        sortOrder.reserve(capacity);
+    }
+
+    size_t getParticleCapacity() const {
+        return particleCapacity;
+    }
+
+    ParticleId getParticleId(size_t slot) const {
+        return particleIds[slot];
+    }
+
+    // Current slot of the particle with the given ID, or -1 for an unknown ID
+    int findParticle(ParticleId id) const {
+        const ParticleId index = id & PARTICLE_ID_INDEX_MASK;
+        if (index >= idSlots.size() || idGenerations[index] != id >> PARTICLE_ID_INDEX_BITS) return -1;
+        return idSlots[index];
+    }
+
+    // Smoothing length of particle i, 0 restores SMOOTHING_LENGTH. A pair interacts over the
+    // mean of both lengths, so either side may reach further than the other. Once any particle
+    // has its own length, the kernels are evaluated in closed form, scaled per pair, and the
+    // vector passes and kernel tables are skipped. QUADTREE searches each particle's own
+    // length; the other backends search the largest length set so far.
+    void setSmoothingLength(size_t i, float h) {
+        smoothingLengths[i] = h;
+        maxSmoothingLength = std::max(maxSmoothingLength, h);
+        variableSmoothing = true;
+        neighborsReady = false;
+    }
+
+    float getSmoothingLength(size_t i) const {
+        return smoothingLengths[i] > 0.f ? smoothingLengths[i] : SMOOTHING_LENGTH;
+    }
+
+    sf::Vector2f getParticlePosition(size_t i) const {
+        return particles.position(i);
+    }
+
+    float getParticleDensity(size_t i) const {
+        return particles.density(i);
+    }
+
+    sf::Vector2f getParticleVelocity(size_t i) const {
+        return particles.velocity(i);
+    }
+
+    // Instruction set each pass of the next step runs with, for the HUD and the log, e.g.
+    // "AVX-512: density, forces; scalar: integrate" for a layout without float arrays
+    std::string describeSimdPasses() const {
+        const bool gather = pairEvaluation == PairEvaluation::GATHER;
+        const bool vector[] = {gather && vectorDensityPass(), gather && vectorForcePass(),
+                               HasVectorIntegrate<Store>::value};
+        const char* passes[] = {"density", "forces", "integrate"};
+        std::string vectorPasses, scalarPasses;
+        for (int k = 0; k < 3; k++) {
+            std::string& list = vector[k] && simd.path != SimdPath::SCALAR ? vectorPasses : scalarPasses;
+            list += (list.empty() ? "" : ", ") + std::string(passes[k]);
+        }
+        std::string description;
+        if (!vectorPasses.empty()) description = std::string(simd.name) + ": " + vectorPasses;
+        if (!scalarPasses.empty()) description += (description.empty() ? "" : "; ") + std::string("scalar: ") + scalarPasses;
+        return description;
+    }
+
+    void update(float dt) {
+        if (!neighborsReady || preparedCutoff != getInteractionRadius() || preparedSearch != neighborSearch) {
+            prepareNeighbors();
+        }
+        tabulatedKernels = usesKernelTables();
+        if (tabulatedKernels && kernelTable.getSupport() != SMOOTHING_LENGTH) {
+            kernelTable.build<Kernels>(SMOOTHING_LENGTH);
+        }
+        stepCount++;
+
+        if (pairEvaluation == PairEvaluation::PAIR_LIST) {
+            buildPairList();
+        }
+        auto densityBegin = std::chrono::steady_clock::now();
+        computeDensityPressure();
+        auto forceBegin = std::chrono::steady_clock::now();
+        computeForces();
+        auto forceEnd = std::chrono::steady_clock::now();
+        integrate(dt);
+        auto integrateEnd = std::chrono::steady_clock::now();
+
+        densityPassMs += std::chrono::duration<double, std::milli>(forceBegin - densityBegin).count();
+        forcePassMs += std::chrono::duration<double, std::milli>(forceEnd - forceBegin).count();
+        integratePassMs += std::chrono::duration<double, std::milli>(integrateEnd - forceEnd).count();
+        timedSteps++;
+
+        // Bin the final positions, so spatial queries between steps and the next step share them
+        prepareNeighbors();
+        searchPassMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - integrateEnd).count();
+    }
+
+    // Writes the indices of particles within radius of center to out, up to capacity of them,
+    // and returns how many there are in total. Indices are valid until the next update().
+    size_t queryRadius(const sf::Vector2f& center, float radius, int* out, size_t capacity) const {
+        const float radiusSq = radius * radius;
+        size_t found = 0;
+        forEachCandidateInRect(center.x - radius, center.y - radius, center.x + radius, center.y + radius,
+                               [&](int j) {
+            sf::Vector2f diff = particles.position(j) - center;
+            if (dot(diff, diff) <= radiusSq) {
+                if (found < capacity) out[found] = j;
+                found++;
+            }
+        });
+        return found;
+    }
+
+    // Same as queryRadius for particles inside rect
+    size_t queryRect(const sf::FloatRect& rect, int* out, size_t capacity) const {
+        size_t found = 0;
+        forEachCandidateInRect(rect.left, rect.top, rect.left + rect.width, rect.top + rect.height, [&](int j) {
+            const sf::Vector2f& pos = particles.position(j);
+            if (pos.x >= rect.left && pos.x <= rect.left + rect.width &&
+                pos.y >= rect.top && pos.y <= rect.top + rect.height) {
+                if (found < capacity) out[found] = j;
+                found++;
+            }
+        });
+        return found;
+    }
+
+    // Writes the k particles nearest to center to out, closest first, and returns how many
+    // were written (fewer than k only if fewer particles have a finite position). The search
+    // radius doubles until it holds k particles, whose k-th nearest is then guaranteed inside it.
+    // A non-finite center finds nothing.
+    size_t queryKNearest(const sf::Vector2f& center, size_t k, int* out) const {
+        if (k == 0 || particles.empty() || !std::isfinite(center.x) || !std::isfinite(center.y)) return 0;
+        k = std::min(k, particles.size());
+
+        auto distanceSq = [&](int j) {
+            sf::Vector2f diff = particles.position(j) - center;
+            return dot(diff, diff);
+        };
+
+        // Insertion into the sorted k best so far, returns whether j lies within the radius.
+        // NaN distances are within none.
+        size_t found = 0;
+        auto insert = [&](int j, float radiusSq) {
+            const float d2 = distanceSq(j);
+            if (!(d2 <= radiusSq)) return false;
+            if (found == k && d2 >= distanceSq(out[k - 1])) return true;
+            size_t slot = found < k ? found++ : k - 1;
+            while (slot > 0 && distanceSq(out[slot - 1]) > d2) {
+                out[slot] = out[slot - 1];
+                slot--;
+            }
+            out[slot] = j;
+            return true;
+        };
+
+        // Once the radius reaches the farthest corner of bounds every particle inside them was
+        // seen. The rest lie outside bounds or at NaN positions, one scan over all particles
+        // finishes the query instead of doubling on.
+        const float farX = std::max(std::abs(center.x - bounds.left), std::abs(center.x - bounds.left - bounds.width));
+        const float farY = std::max(std::abs(center.y - bounds.top), std::abs(center.y - bounds.top - bounds.height));
+        const float coverRadius = std::sqrt(farX * farX + farY * farY);
+        for (float radius = getInteractionRadius(); radius < coverRadius; radius *= 2.f) {
+            const float radiusSq = radius * radius;
+            size_t inside = 0;
+            found = 0;
+            forEachCandidateInRect(center.x - radius, center.y - radius, center.x + radius, center.y + radius,
+                                   [&](int j) { inside += insert(j, radiusSq); });
+            if (inside >= k) return found;
+        }
+
+        found = 0;
+        for (size_t j = 0; j < particles.size(); j++) {
+            insert(static_cast<int>(j), std::numeric_limits<float>::infinity());
+        }
+        return found;
+    }
+
+    // Largest distance at which two particles interact: the kernel support or the contact distance
+    float getInteractionRadius() const {
+        return std::max(std::max(SMOOTHING_LENGTH, maxSmoothingLength), 2 * PARTICLE_RADIUS);
+    }
+
+    size_t getParticleCount() const {
+        return particles.size();
+    }
+
+    // Morton reorderings so far, at most one per step
+    long getReorderCount() const {
+        return reorderCount;
+    }
+
+    // Fraction of steps that had to rebuild the Verlet lists
+    float getVerletRebuildRate() const {
+        return stepCount > 0 ? static_cast<float>(verletBuildCount) / stepCount : 0.f;
+    }
+
+    size_t getPairCount() const {
+        return pairList.size();
+    }
+
+    // Memory held by the cached pair list, sizeof(NeighborPair) bytes per pair
+    size_t getPairListBytes() const {
+        return pairList.capacity() * sizeof(NeighborPair);
+    }
+
+    const SpatialHash& getSpatialHash() const {
+        return spatialHash;
+    }
+
+    const VerletLists& getVerletLists() const {
+        return verletLists;
+    }
+
+    // Fraction of steps in which INCREMENTAL_GRID fell back to a full counting sort
+    float getGridFullBuildRate() const {
+        return stepCount > 0 ? static_cast<float>(gridFullBuildCount) / stepCount : 0.f;
+    }
+
+    // Particles the grid had to move in the last step
+    int getGridRebinnedParticles() const {
+        return grid.getLastMoved();
+    }
+
+    // Average milliseconds per step of computeDensityPressure(), computeForces() and integrate()
+    double getDensityPassMs() const {
+        return timedSteps > 0 ? densityPassMs / timedSteps : 0.0;
+    }
+
+    double getForcePassMs() const {
+        return timedSteps > 0 ? forcePassMs / timedSteps : 0.0;
+    }
+
+    double getIntegratePassMs() const {
+        return timedSteps > 0 ? integratePassMs / timedSteps : 0.0;
+    }
+
+    // Average milliseconds per step of the prepareNeighbors() that ends each update()
+    double getSearchPassMs() const {
+        return timedSteps > 0 ? searchPassMs / timedSteps : 0.0;
+    }
+
+    // Fraction of the steps since resetPassTimes() that rebuilt the Verlet lists
+    float getTimedVerletRebuildRate() const {
+        return timedSteps > 0 ? static_cast<float>(timedVerletBuilds) / timedSteps : 0.f;
+    }
+
+    void resetPassTimes() {
+        densityPassMs = 0.0;
+        forcePassMs = 0.0;
+        integratePassMs = 0.0;
+        searchPassMs = 0.0;
+        timedSteps = 0;
+        timedVerletBuilds = 0;
+    }
+
+    // Largest relative density difference against brute force in the last cross-checked step
+    float getCrossCheckDensityError() const {
+        return crossCheckDensityError;
+    }
+
+    // Largest relative difference of the vector density pass against the scalar one in the last
+    // cross-checked GATHER step
+    float getCrossCheckVectorDensityError() const {
+        return crossCheckVectorDensityError;
+    }
+
+    // Largest difference of the vector force pass against the scalar terms in the last
+    // cross-checked GATHER step, relative to the summed term magnitudes
+    float getCrossCheckVectorForceError() const {
+        return crossCheckVectorForceError;
+    }
+
+    // Pairs within the interaction radius that brute force found but the neighbor search did not
+    int getCrossCheckMissedPairs() const {
+        return crossCheckMissedPairs;
+    }
+
+    void shake() {
+        for (size_t i = 0; i < particles.size(); i++) {
+                switch(rand() % 4) {
+                case 0:
+                    particles.vy(i) += static_cast<float>(rand() % 10000);
+                    break;
+                case 1:
+                    particles.vx(i) += static_cast<float>(rand() % 10000);
+                    break;
+                case 2:
+                    particles.vy(i) -= static_cast<float>(rand() % 10000);
+                    break;
+                case 3:
+                    particles.vx(i) -= static_cast<float>(rand() % 10000);
+                    break;
+            }
+        }
+    }
+
+    void wind(int direction, float force) {
+        // 0123 - up right down left
+        switch(direction) {
+            case 0:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    particles.vy(i) -= force;
+                }
+                break;
+            case 1:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    particles.vx(i) += force;
+                }
+                break;
+            case 2:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    particles.vy(i) += force;
+                }
+                break;
+            case 3:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    particles.vx(i) -= force;
+                }
+                break;
+        }
+    }
+
+    void draw(sf::RenderTarget& target) {
+        buildVertices();
+        target.draw(particleVertices);
+    }
+
+    // Fills the vertex array draw() hands to the target, CIRCLE_SEGMENTS triangles per particle
+    void buildVertices() {
+        // Find max pressure in current frame for dynamic scaling
+        float max_pressure = 0.0f;
+        for (size_t i = 0; i < particles.size(); i++) {
+            max_pressure = std::max(max_pressure, static_cast<float>(particles.pressure(i)));
+
+        }
+
+        // Avoid division by zero
+        max_pressure = std::max(max_pressure, 0.0001f);
+
+        // Circle outline around the center, the position is the top left corner of the circle
+        sf::Vector2f outline[CIRCLE_SEGMENTS + 1];
+        for (int s = 0; s <= CIRCLE_SEGMENTS; s++) {
+            float angle = 2.f * 3.14159265f * s / CIRCLE_SEGMENTS;
+            outline[s] = sf::Vector2f(std::cos(angle), std::sin(angle)) * PARTICLE_RADIUS;
+        }
+        const sf::Vector2f centerOffset(PARTICLE_RADIUS, PARTICLE_RADIUS);
+
+        // One batch of triangles for all particles, resize keeps its memory between frames
+        particleVertices.setPrimitiveType(sf::Triangles);
+        particleVertices.resize(particles.size() * CIRCLE_SEGMENTS * 3);
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            // Normalize pressure between 0 and 1
+            float pressure_scale = particles.pressure(i) / max_pressure;
+
+            // Create a color gradient from blue (low pressure) to red (high pressure)
+            sf::Color color(
+                static_cast<sf::Uint8>(200 * pressure_scale),                    // Red
+                static_cast<sf::Uint8>(100 * (1.0f - pressure_scale)),          // Green
+                static_cast<sf::Uint8>(255 * (1.0f - pressure_scale))           // Blue
+            );
+            if (!show_coloring)
+                color = sf::Color::Cyan;
+
+            const sf::Vector2f center = particles.position(i) + centerOffset;
+            sf::Vertex* triangles = &particleVertices[i * CIRCLE_SEGMENTS * 3];
+            for (int s = 0; s < CIRCLE_SEGMENTS; s++) {
+                triangles[3 * s] = sf::Vertex(center, color);
+                triangles[3 * s + 1] = sf::Vertex(center + outline[s], color);
+                triangles[3 * s + 2] = sf::Vertex(center + outline[s + 1], color);
+            }
+        }
+    }
+private:
+    // Moves the particle in slot from, with its per-slot data, into slot to
+    void moveSlot(size_t from, size_t to) {
+        particles.set(to, particles.get(from));
+        smoothingLengths[to] = smoothingLengths[from];
+        particleIds[to] = particleIds[from];
+        idSlots[particleIds[to] & PARTICLE_ID_INDEX_MASK] = static_cast<int>(to);
+    }
+
+    // Free ID indices first, then a new one. The last index is never handed out, as its last
+    // generation would be INVALID_PARTICLE_ID.
+    ParticleId acquireId(size_t slot) {
+        ParticleId index;
+        if (!freeIds.empty()) {
+            index = freeIds.back();
+            freeIds.pop_back();
+            idSlots[index] = static_cast<int>(slot);
+        } else if (idSlots.size() < PARTICLE_ID_INDEX_MASK) {
+            index = static_cast<ParticleId>(idSlots.size());
+            idSlots.push_back(static_cast<int>(slot));
+            idGenerations.push_back(0);
+        } else {
+            return INVALID_PARTICLE_ID;
+        }
+        return idGenerations[index] << PARTICLE_ID_INDEX_BITS | index;
+    }
+
+    // IDs addParticle() can still hand out
+    size_t availableIds() const {
+        return freeIds.size() + (PARTICLE_ID_INDEX_MASK - idSlots.size());
+    }
+
+    // count particles row by row, columns per row
+    size_t spawnLattice(const sf::Vector2f& origin, int columns, size_t count, const sf::Vector2f& spacing,
+                        float jitter, std::uint32_t seed) {
+        const size_t first = particles.size();
+        if (particleCapacity > 0) {
+            count = std::min(count, particleCapacity - std::min(first, particleCapacity));
+        }
+        count = std::min(count, availableIds());
+        if (count == 0) return 0;
+
+        particles.resize(first + count);
+        smoothingLengths.resize(first + count, 0.f);
+        particleIds.resize(first + count);
+        for (size_t k = 0; k < count; k++) {
+            particleIds[first + k] = acquireId(first + k);
+        }
+
+        sharedWorkerPool().parallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                SpawnRandom random(seed, k);
+                const float col = static_cast<float>(k % columns);
+                const float row = static_cast<float>(k / columns);
+                const float jitterX = jitter * random.nextSigned();
+                const float jitterY = jitter * random.nextSigned();
+                particles.setPosition(first + k, sf::Vector2f(origin.x + col * spacing.x + jitterX,
+                                                              origin.y + row * spacing.y + jitterY));
+            }
+        });
+        neighborsReady = false;
+        return count;
+    }
+
+    // The next particle on this index gets the next generation. An index that used up its
+    // generations is retired.
+    void releaseId(ParticleId id) {
+        const ParticleId index = id & PARTICLE_ID_INDEX_MASK;
+        idSlots[index] = -1;
+        if (++idGenerations[index] < PARTICLE_ID_GENERATIONS) {
+            freeIds.push_back(index);
+        }
+    }
+
+    // Sorts the particle storage by the Morton code of each particle's cell, so that
+    // particles close in space are also close in memory. Keys are sorted by RadixSorter and the
+    // permutation is applied to all particle attributes in one parallel gather pass, which
+    // also points each particle ID at its new slot.
+    void reorderParticles() {
+        WorkerPool& pool = sharedWorkerPool();
+        const float invCellSize = 1.f / getInteractionRadius();
+        const size_t count = particles.size();
+        sortKeys.resize(count);
+
+        pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                float cx = (particles.x(i) - bounds.left) * invCellSize;
+                float cy = (particles.y(i) - bounds.top) * invCellSize;
+                cx = std::min(std::max(0.f, cx), 65535.f);
+                cy = std::min(std::max(0.f, cy), 65535.f);
+                sortKeys[i] = mortonCode(static_cast<unsigned int>(cx), static_cast<unsigned int>(cy));
+            }
+        });
+        radixSorter.sort(sortKeys, sortOrder, pool);
+
+        // Slot k receives particle sortOrder[k]
+        reordered.resize(count);
+        reorderedSmoothingLengths.resize(count);
+        reorderedIds.resize(count);
+        pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+            reordered.gather(particles, sortOrder.data(), begin, end);
+            for (size_t k = begin; k < end; k++) {
+                reorderedSmoothingLengths[k] = smoothingLengths[sortOrder[k]];
+                reorderedIds[k] = particleIds[sortOrder[k]];
+                idSlots[reorderedIds[k] & PARTICLE_ID_INDEX_MASK] = static_cast<int>(k);
+            }
+        });
+        particles.swap(reordered);
+        smoothingLengths.swap(reorderedSmoothingLengths);
+        particleIds.swap(reorderedIds);
+
+        verletLists.invalidate();
+        grid.invalidate();
+    }
+
+    void prepareNeighbors() {
+        const float cutoff = getInteractionRadius();
+        // A step prepares twice when particles were added or removed or the backend changed
+        // since the last one, the second time finds the particles still sorted
+        if (REORDER_INTERVAL > 0 && stepCount % REORDER_INTERVAL == 0 && stepCount != lastReorderStep) {
+            reorderParticles();
+            lastReorderStep = stepCount;
+            reorderCount++;
+        }
+        if (preparedSearch != neighborSearch) {
+            // The grid and lists of another backend may be built for other cells or older slots
+            verletLists.invalidate();
+            grid.invalidate();
+        }
+        neighborsReady = true;
+        preparedCutoff = cutoff;
+        preparedSearch = neighborSearch;
+
+        switch (neighborSearch) {
+            case NeighborSearch::BRUTE_FORCE:
+                break;
+            case NeighborSearch::UNIFORM_GRID:
+                grid.build(particles, bounds, cutoff);
+                break;
+            case NeighborSearch::VERLET_LIST:
+                if (verletLists.isCompressed() != compressNeighborLists ||
+                    verletLists.needsRebuild(particles, cutoff, VERLET_SKIN)) {
+                    grid.build(particles, bounds, cutoff + VERLET_SKIN);
+                    verletLists.build(particles, grid, cutoff, VERLET_SKIN, compressNeighborLists);
+                    verletBuildCount++;
+                    timedVerletBuilds++;
+                }
+                break;
+            case NeighborSearch::SPATIAL_HASH:
+                spatialHash.build(particles, cutoff);
+                break;
+            case NeighborSearch::QUADTREE:
+                quadtree.build(particles, smoothingLengths, SMOOTHING_LENGTH, sharedWorkerPool(), 2 * PARTICLE_RADIUS);
+                break;
+            case NeighborSearch::INCREMENTAL_GRID:
+                if (!grid.update(particles, bounds, cutoff, REBIN_MAX_MOVED_SHARE)) {
+                    grid.build(particles, bounds, cutoff, true);
+                    gridFullBuildCount++;
+                }
+                break;
+        }
+    }
+
+    // Calls fn(j) for every particle that may lie in the rectangle, using the structure the last
+    // step prepared, even if neighborSearch changed since. Before the first update everything is visited.
+    template <typename Fn>
+    void forEachCandidateInRect(float minX, float minY, float maxX, float maxY, Fn&& fn) const {
+        if (!neighborsReady) {
+            for (size_t j = 0; j < particles.size(); j++) fn(static_cast<int>(j));
+            return;
+        }
+
+        switch (preparedSearch) {
+            case NeighborSearch::BRUTE_FORCE:
+                for (size_t j = 0; j < particles.size(); j++) fn(static_cast<int>(j));
+                break;
+            case NeighborSearch::UNIFORM_GRID:
+            case NeighborSearch::INCREMENTAL_GRID:
+                grid.forEachInRect(minX, minY, maxX, maxY, fn);
+                break;
+            case NeighborSearch::VERLET_LIST: {
+                // The grid is from the last list build, particles have moved less than half the skin since
+                const float margin = 0.5f * VERLET_SKIN;
+                grid.forEachInRect(minX - margin, minY - margin, maxX + margin, maxY + margin, fn);
+                break;
+            }
+            case NeighborSearch::SPATIAL_HASH:
+                spatialHash.forEachInRect(minX, minY, maxX, maxY, fn);
+                break;
+            case NeighborSearch::QUADTREE:
+                quadtree.forEachInRect(minX, minY, maxX, maxY, fn);
+                break;
+        }
+    }
+
+    // Calls fn(j) for every particle that may interact with particle i, including i itself
+    template <typename Fn>
+    void forEachNeighbor(size_t i, Fn&& fn) const {
+        switch (neighborSearch) {
+            case NeighborSearch::BRUTE_FORCE:
+                for (size_t j = 0; j < particles.size(); j++) {
+                    fn(static_cast<int>(j));
+                }
+                break;
+            case NeighborSearch::UNIFORM_GRID:
+            case NeighborSearch::INCREMENTAL_GRID:
+                grid.forEachCandidate(particles.position(i), fn);
+                break;
+            case NeighborSearch::VERLET_LIST:
+                verletLists.forEachNeighbor(i, fn);
+                break;
+            case NeighborSearch::SPATIAL_HASH:
+                spatialHash.forEachCandidate(particles.position(i), fn);
+                break;
+            case NeighborSearch::QUADTREE:
+                quadtree.forEachNeighbor(particles, particles.position(i), quadtree.getRadius(i),
+                                         Quadtree::SYMMETRIC, fn);
+                break;
+        }
+    }
+
+    // Calls fn(i, j) once for every unordered pair of distinct particles that may interact
+    template <typename Fn>
+    void forEachPair(Fn&& fn) const {
+        switch (neighborSearch) {
+            case NeighborSearch::BRUTE_FORCE:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    for (size_t j = i + 1; j < particles.size(); j++) {
+                        fn(static_cast<int>(i), static_cast<int>(j));
+                    }
+                }
+                break;
+            case NeighborSearch::UNIFORM_GRID:
+            case NeighborSearch::INCREMENTAL_GRID:
+                grid.forEachPair(fn);
+                break;
+            case NeighborSearch::VERLET_LIST:
+                verletLists.forEachPair(fn);
+                break;
+            case NeighborSearch::SPATIAL_HASH:
+                spatialHash.forEachPair(fn);
+                break;
+            case NeighborSearch::QUADTREE:
+                for (size_t i = 0; i < particles.size(); i++) {
+                    quadtree.forEachNeighbor(particles, particles.position(i), quadtree.getRadius(i),
+                                             Quadtree::SYMMETRIC, [&](int j) {
+                        if (j > static_cast<int>(i)) fn(static_cast<int>(i), j);
+                    });
+                }
+                break;
+        }
+    }
+
+    // Collects every pair within the interaction radius together with its geometry, so the
+    // density and force passes skip the distance and sqrt. Collisions in the force pass move
+    // particles afterwards, later pairs keep using the geometry from the start of the step.
+    void buildPairList() {
+        const float cutoffSq = getInteractionRadius() * getInteractionRadius();
+        pairList.clear();
+
+        forEachPair([&](int i, int j) {
+            sf::Vector2f diff = particles.position(i) - particles.position(j);
+            float r2 = diff.x * diff.x + diff.y * diff.y;
+            if (r2 >= cutoffSq) return;
+
+            NeighborPair pair;
+            pair.i = i;
+            pair.j = j;
+            pair.diff = diff;
+            pair.r = std::sqrt(r2);
+            pair.invR = pair.r > 0.0001f ? 1.f / pair.r : 0.f;
+            pair.hMinusR = pairSupport(i, j) - pair.r;
+            pairList.push_back(pair);
+        });
+    }
+
+    // Kernels of the current step, closed form or from kernelTable
+    float densityKernel(float r2) const {
+        return tabulatedKernels ? kernelTable.value(r2) : Kernels::Density::value(r2);
+    }
+
+    float gradientKernel(float r) const {
+        return tabulatedKernels ? kernelTable.gradient(r) : Kernels::Gradient::gradient(r);
+    }
+
+    float viscosityKernel(float r) const {
+        return tabulatedKernels ? kernelTable.laplacian(r) : Kernels::Viscosity::laplacian(r);
+    }
+
+    // Kernels for the support h of a pair. The closed forms are written for KERNEL_SUPPORT, in 2D
+    // W_h(r) = s^2 W(s r) with s = KERNEL_SUPPORT / h and one more factor s per derivative.
+    float densityKernel(float r2, float h) const {
+        if (!variableSmoothing) return densityKernel(r2);
+        const float s = KERNEL_SUPPORT / h;
+        return s * s * Kernels::Density::value(r2 * s * s);
+    }
+
+    float gradientKernel(float r, float h) const {
+        if (!variableSmoothing) return gradientKernel(r);
+        const float s = KERNEL_SUPPORT / h;
+        return s * s * s * Kernels::Gradient::gradient(r * s);
+    }
+
+    float viscosityKernel(float r, float h) const {
+        if (!variableSmoothing) return viscosityKernel(r);
+        const float s = KERNEL_SUPPORT / h;
+        return s * s * s * s * Kernels::Viscosity::laplacian(r * s);
+    }
+
+    // Kernel support of the pair i, j. The mean of both smoothing lengths keeps every kernel term
+    // symmetric in the pair, so gathering and scattering agree and pressure forces still cancel.
+    float pairSupport(size_t i, size_t j) const {
+        return variableSmoothing ? 0.5f * (getSmoothingLength(i) + getSmoothingLength(j)) : SMOOTHING_LENGTH;
+    }
+
+    float densityContribution(size_t i, size_t j) const {
+        sf::Vector2f diff = particles.position(i) - particles.position(j);
+        float r2 = diff.x * diff.x + diff.y * diff.y;
+        const float h = pairSupport(i, j);
+
+        if (r2 < h * h) {
+            return PARTICLE_MASS * densityKernel(r2, h);
+        }
+        return 0.f;
+    }
+
+    // Whether particles i and j are close enough for a kernel term or a collision
+    bool interacts(size_t i, size_t j) const {
+        const sf::Vector2f diff = particles.position(i) - particles.position(j);
+        const float reach = std::max(pairSupport(i, j), 2 * PARTICLE_RADIUS);
+        return dot(diff, diff) < reach * reach;
+    }
+
+    // Compares the density computed for particle i, before the store rounds it, and its neighbors
+    // against a brute force scan over all particles
+    void crossCheckParticle(size_t i, float density) {
+        int foundPairs = 0;
+        forEachNeighbor(i, [&](int j) {
+            foundPairs += interacts(i, j);
+        });
+
+        float reference = 0.f;
+        int referencePairs = 0;
+        for (size_t j = 0; j < particles.size(); j++) {
+            reference += densityContribution(i, j);
+            referencePairs += interacts(i, j);
+        }
+
+        float error = std::abs(density - reference) / std::max(reference, 0.0001f);
+        crossCheckDensityError = std::max(crossCheckDensityError, error);
+        crossCheckMissedPairs += std::max(referencePairs - foundPairs, 0);
+    }
+
+    // Reference density of particle i, one neighbor at a time
+    float scalarDensity(size_t i) const {
+        float density = 0.f;
+        forEachNeighbor(i, [&](int j) {
+            density += densityContribution(i, j);
+        });
+        return density;
+    }
+
+    void resizeCandidates(size_t size) {
+        for (AlignedFloats* array : {&candidateXs, &candidateYs, &candidateVxs, &candidateVys,
+                                     &candidatePressures, &candidateDensities}) {
+            array->resize(size);
+        }
+        candidateIds.resize(size);
+        candidateContacts.resize(size);
+        candidateHalves.resize(size);
+    }
+
+    // The pair force passes read both densities and pressures of every pair. A packed store
+    // converts them once per particle into float arrays first.
+    void decodePackedDensityPressure() {
+        decodePackedDensityPressure(particles);
+    }
+
+    template <typename AnyStore>
+    void decodePackedDensityPressure(const AnyStore&) {}
+
+    void decodePackedDensityPressure(const CompactParticleStore& store) {
+        pairDensities.resize(store.size());
+        pairPressures.resize(store.size());
+        simd.halvesToFloats(store.densityData(), pairDensities.data(), store.size());
+        simd.halvesToFloats(store.pressureData(), pairPressures.data(), store.size());
+        for (float& pressure : pairPressures) pressure *= PRESSURE_HALF_SCALE;
+    }
+
+    float pairDensity(size_t i) const {
+        return HasPackedAttributes<Store>::value ? pairDensities[i] : static_cast<float>(particles.density(i));
+    }
+
+    float pairPressure(size_t i) const {
+        return HasPackedAttributes<Store>::value ? pairPressures[i] : static_cast<float>(particles.pressure(i));
+    }
+
+    // A table holds one support, per particle smoothing lengths scale the closed forms instead
+    bool usesKernelTables() const {
+        return !variableSmoothing && (kernelEvaluation == KernelEvaluation::TABLE || SMOOTHING_LENGTH != KERNEL_SUPPORT);
+    }
+
+    // Whether the GATHER density and force passes run in SIMD registers, which only have the
+    // closed forms of the default kernels at one support
+    bool vectorDensityPass() const {
+        return vectorizedDensity && !usesKernelTables() && !variableSmoothing &&
+               std::is_same<typename Kernels::Density, Poly6Kernel>::value;
+    }
+
+    bool vectorForcePass() const {
+        return vectorizedForces && !usesKernelTables() && !variableSmoothing &&
+               std::is_same<typename Kernels::Gradient, SpikyGradientKernel>::value &&
+               std::is_same<typename Kernels::Viscosity, ViscosityLaplacianKernel>::value;
+    }
+
+    // Collects the neighbors of particle i into the candidate arrays and returns their count
+    // padded to the SIMD width with points far outside the support. Velocity, pressure and
+    // density are only collected for the force pass.
+    size_t collectCandidates(size_t i, bool forForces) {
+        size_t count = 0;
+        forEachNeighbor(i, [&](int j) {
+            if (count == candidateXs.size()) {
+                resizeCandidates(std::max<size_t>(256, 2 * count));
+            }
+            candidateXs[count] = particles.x(j);
+            candidateYs[count] = particles.y(j);
+            if (forForces) {
+                candidateIds[count] = j;
+            }
+            if (forForces && !HasPackedAttributes<Store>::value) {
+                candidateVxs[count] = particles.vx(j);
+                candidateVys[count] = particles.vy(j);
+                candidatePressures[count] = particles.pressure(j);
+                candidateDensities[count] = particles.density(j);
+            }
+            count++;
+        });
+        if (forForces && HasPackedAttributes<Store>::value) {
+            gatherPackedCandidates(particles, simd, candidateIds.data(), count, candidateHalves.data(),
+                                   candidateVxs.data(), candidateVys.data(), candidatePressures.data(),
+                                   candidateDensities.data());
+        }
+
+        const size_t width = static_cast<size_t>(simd.width);
+        const size_t padded = (count + width - 1) / width * width;
+        if (padded > candidateXs.size()) {
+            resizeCandidates(padded);
+        }
+        for (size_t k = count; k < padded; k++) {
+            candidateXs[k] = 1e18f;
+            candidateYs[k] = 1e18f;
+            candidateVxs[k] = 0.f;
+            candidateVys[k] = 0.f;
+            candidatePressures[k] = 0.f;
+            candidateDensities[k] = 1.f;
+        }
+        return padded;
+    }
+
+    // Poly6 density of particle i with simd.width neighbors per instruction
+    float vectorDensity(size_t i) {
+        const size_t count = collectCandidates(i, false);
+        const sf::Vector2f pos = particles.position(i);
+        const float sum = simd.poly6Sum(pos.x, pos.y, candidateXs.data(), candidateYs.data(), count);
+        return PARTICLE_MASS * Poly6Kernel::SCALE * sum;
+    }
+
+    void computeDensityPressure() {
+        crossCheckDensityError = 0.f;
+        crossCheckMissedPairs = 0;
+
+        if (pairEvaluation != PairEvaluation::GATHER) {
+            // The kernel only depends on r, so one evaluation serves both particles of a pair.
+            // The sums stay in float until they are complete, a packed store would round each
+            // contribution.
+            pairDensities.assign(particles.size(), PARTICLE_MASS * densityKernel(0.f));
+            if (variableSmoothing) {
+                for (size_t i = 0; i < particles.size(); i++) {
+                    pairDensities[i] = PARTICLE_MASS * densityKernel(0.f, getSmoothingLength(i));
+                }
+            }
+        }
+
+        if (pairEvaluation == PairEvaluation::PAIR_ONCE) {
+            forEachPair([&](int i, int j) {
+                float contribution = densityContribution(i, j);
+                pairDensities[i] += contribution;
+                pairDensities[j] += contribution;
+            });
+        } else if (pairEvaluation == PairEvaluation::PAIR_LIST) {
+            for (const auto& pair : pairList) {
+                if (pair.hMinusR <= 0.f) continue;
+                float contribution = PARTICLE_MASS * densityKernel(pair.r * pair.r, pair.hMinusR + pair.r);
+                pairDensities[pair.i] += contribution;
+                pairDensities[pair.j] += contribution;
+            }
+        }
+
+        const bool vectorPass = vectorDensityPass();
+        crossCheckVectorDensityError = 0.f;
+        for (size_t i = 0; i < particles.size(); i++) {
+            float density;
+            if (pairEvaluation == PairEvaluation::GATHER) {
+                density = vectorPass ? vectorDensity(i) : scalarDensity(i);
+                if (crossCheck && vectorPass) {
+                    const float reference = scalarDensity(i);
+                    crossCheckVectorDensityError = std::max(crossCheckVectorDensityError,
+                        std::abs(density - reference) / std::max(reference, 0.0001f));
+                }
+            } else {
+                density = pairDensities[i];
+            }
+            particles.density(i) = density;
+
+            if (crossCheck) {
+                crossCheckParticle(i, density);
+            }
+
+            particles.pressure(i) = GAS_CONSTANT * (density - REST_DENSITY);
+        }
+    }
+
+    // Impulse based response for overlapping particles, returns true when it was applied.
+    // Callers skip r ~ 0: particles clamped into the same border corner coincide exactly
+    // and have no collision normal.
+    bool resolveCollision(int i, int j, const sf::Vector2f& diff, float r) {
+        sf::Vector2f normalized_diff = diff / r; // Collision normal
+
+        // Calculate relative velocity
+        sf::Vector2f relative_velocity = particles.velocity(i) - particles.velocity(j);
+
+        // Normal velocity component (along collision normal)
+        float normal_velocity = dot(relative_velocity, normalized_diff);
+
+        // Only resolve if particles are moving toward each other
+        if (normal_velocity >= 0) {
+            return false;
+        }
+
+        // Coefficient of restitution (1.0 = perfectly elastic)
+        const float RESTITUTION = 0.8f;
+
+        // Calculate impulse
+        float impulse = -(1.0f + RESTITUTION) * normal_velocity;
+        impulse /= 2.0f; // Assuming equal mass for both particles
+
+        // Apply impulse
+        particles.addVelocity(i, normalized_diff * impulse);
+        particles.addVelocity(j, -normalized_diff * impulse);
+
+        // Separate particles to prevent overlap
+        float overlap = 2 * PARTICLE_RADIUS - r;
+        sf::Vector2f separation = normalized_diff * (overlap * 0.5f);
+        particles.movePosition(i, separation);
+        particles.movePosition(j, -separation);
+        return true;
+    }
+
+    void applyFluidForce(size_t i, const sf::Vector2f& fluidForce) {
+        // Combine all forces: pressure, viscosity, and gravity
+        const float density = particles.density(i);
+        sf::Vector2f force = fluidForce + gravity * density;
+
+        // Limit force magnitude
+        float force_magnitude = std::sqrt(force.x * force.x + force.y * force.y);
+        if (force_magnitude > MAX_VELOCITY * density) {
+            force *= (MAX_VELOCITY * density / force_magnitude);
+        }
+        particles.setForce(i, force);
+    }
+
+    // Pressure and viscosity force on particle i, one neighbor at a time and without collisions.
+    // magnitude, if given, receives the summed magnitudes of the individual terms, and
+    // neighbors within the contact distance are appended to contactsOut as in the vector pass.
+    sf::Vector2f scalarFluidForce(size_t i, float* magnitude,
+                                  std::vector<std::pair<int, int>>* contactsOut = nullptr) const {
+        const sf::Vector2f pos = particles.position(i);
+        const sf::Vector2f velocity = particles.velocity(i);
+        const float pressure = particles.pressure(i);
+        const float density = particles.density(i);
+        const float contactSq = 4.f * PARTICLE_RADIUS * PARTICLE_RADIUS;
+        sf::Vector2f force(0.f, 0.f);
+        if (magnitude) *magnitude = 0.f;
+        forEachNeighbor(i, [&](int j) {
+            sf::Vector2f diff = pos - particles.position(j);
+            const float r2 = diff.x * diff.x + diff.y * diff.y;
+            float r = std::sqrt(r2);
+            if (contactsOut && r2 < contactSq && r > 0.0001f) {
+                contactsOut->push_back(std::make_pair(static_cast<int>(i), j));
+            }
+            const float h = pairSupport(i, j);
+            if (r < h && r > 0.0001f) {
+                const float densityJ = particles.density(j);
+                float pressure_scale = (pressure + particles.pressure(j)) / (2.f * density * densityJ);
+                sf::Vector2f pressure_force = diff / r * (PARTICLE_MASS * pressure_scale * gradientKernel(r, h));
+                sf::Vector2f viscosity_force = (particles.velocity(j) - velocity) *
+                    (PARTICLE_MASS * VISCOSITY / densityJ * viscosityKernel(r, h));
+                force += pressure_force + viscosity_force;
+                if (magnitude) {
+                    *magnitude += std::sqrt(dot(pressure_force, pressure_force)) + std::sqrt(dot(viscosity_force, viscosity_force));
+                }
+            }
+        });
+        return force;
+    }
+
+    // Spiky and viscosity force on particle i with simd.width neighbors per instruction.
+    // Neighbors within the contact distance are appended to contacts.
+    sf::Vector2f vectorFluidForce(size_t i) {
+        ForceCandidates candidates;
+        candidates.count = collectCandidates(i, true);
+        candidates.x = candidateXs.data();
+        candidates.y = candidateYs.data();
+        candidates.vx = candidateVxs.data();
+        candidates.vy = candidateVys.data();
+        candidates.pressure = candidatePressures.data();
+        candidates.density = candidateDensities.data();
+        candidates.contactSq = 4.f * PARTICLE_RADIUS * PARTICLE_RADIUS;
+        candidates.contacts = candidateContacts.data();
+
+        const sf::Vector2f force = simd.spikyViscosityForce(particles.get(i), candidates, PARTICLE_MASS, VISCOSITY);
+        for (size_t k = 0; k < candidates.contactCount; k++) {
+            contacts.push_back(std::make_pair(static_cast<int>(i), candidateIds[candidateContacts[k]]));
+        }
+        return force;
+    }
+
+    // Hard sphere collisions after all fluid forces of the vector pass are known, in the order
+    // the gathering loop met them. Earlier collisions move particles, so each contact is measured
+    // again. They act on velocities and positions only, as in the pair-once pass.
+    void resolveContacts() {
+        const float contactSq = 4.f * PARTICLE_RADIUS * PARTICLE_RADIUS;
+        for (const auto& contact : contacts) {
+            sf::Vector2f diff = particles.position(contact.first) - particles.position(contact.second);
+            float r2 = diff.x * diff.x + diff.y * diff.y;
+            float r = std::sqrt(r2);
+            if (r2 < contactSq && r > 0.0001f) {
+                resolveCollision(contact.first, contact.second, diff, r);
+            }
+        }
+    }
+
+    // GATHER forces: fluid forces of all particles from the same positions, then the collision
+    // pass. The vector and scalar arithmetic collect the same contacts, so vectorizedForces only
+    // changes rounding.
+    void computeForcesGather(bool vectorPass) {
+        crossCheckVectorForceError = 0.f;
+        contacts.clear();
+        for (size_t i = 0; i < particles.size(); i++) {
+            if (!vectorPass) {
+                applyFluidForce(i, scalarFluidForce(i, nullptr, &contacts));
+                continue;
+            }
+            const sf::Vector2f fluidForce = vectorFluidForce(i);
+            if (crossCheck) {
+                float magnitude;
+                const sf::Vector2f difference = fluidForce - scalarFluidForce(i, &magnitude);
+                crossCheckVectorForceError = std::max(crossCheckVectorForceError,
+                    std::sqrt(dot(difference, difference)) / std::max(magnitude, 0.0001f));
+            }
+            applyFluidForce(i, fluidForce);
+        }
+        resolveContacts();
+    }
+
+    void computeForces() {
+        if (pairEvaluation == PairEvaluation::PAIR_ONCE) {
+            computeForcesSymmetric();
+            return;
+        }
+        if (pairEvaluation == PairEvaluation::PAIR_LIST) {
+            computeForcesFromPairList();
+            return;
+        }
+        computeForcesGather(vectorForcePass());
+    }
+
+    // Pair-once variant of computeForces: each pair computes distance, sqrt and kernel terms
+    // a single time and scatters equal and opposite pressure forces to both particles.
+    // The force arrays accumulate the fluid force until applyFluidForce finishes it, so collisions
+    // do not clear it, the same as in the gathering pass.
+    void computeForcesSymmetric() {
+        const float cutoffSq = getInteractionRadius() * getInteractionRadius();
+        for (size_t i = 0; i < particles.size(); i++) {
+            particles.setForce(i, sf::Vector2f(0.f, 0.f));
+        }
+
+        decodePackedDensityPressure();
+
+        forEachPair([&](int i, int j) {
+            sf::Vector2f diff = particles.position(i) - particles.position(j);
+            float r2 = diff.x * diff.x + diff.y * diff.y;
+            if (r2 >= cutoffSq) return;
+            float r = std::sqrt(r2);
+            const float h = pairSupport(i, j);
+
+            if (r < h && r > 0.0001f) {
+                const float densityI = pairDensity(i);
+                const float densityJ = pairDensity(j);
+
+                // Pressure force, antisymmetric in the pair
+                float pressure_scale = (pairPressure(i) + pairPressure(j)) / (2.f * densityI * densityJ);
+                sf::Vector2f pressure_force = diff * (PARTICLE_MASS * pressure_scale * gradientKernel(r, h) / r);
+                particles.addForce(i, pressure_force);
+                particles.addForce(j, -pressure_force);
+
+                // Viscosity force, each side is divided by the other particle's density
+                float viscosity_scale = PARTICLE_MASS * VISCOSITY * viscosityKernel(r, h);
+                sf::Vector2f dv = particles.velocity(j) - particles.velocity(i);
+                particles.addForce(i, dv * (viscosity_scale / densityJ));
+                particles.addForce(j, -dv * (viscosity_scale / densityI));
+            }
+
+            // Check for overlap (distance between particles < 2 * radius)
+            if (r < 2 * PARTICLE_RADIUS && r > 0.0001f) {
+                resolveCollision(i, j, diff, r);
+            }
+        });
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            applyFluidForce(i, particles.force(i));
+        }
+    }
+
+    // Same as computeForcesSymmetric with the distances cached in pairList
+    void computeForcesFromPairList() {
+        for (size_t i = 0; i < particles.size(); i++) {
+            particles.setForce(i, sf::Vector2f(0.f, 0.f));
+        }
+
+        decodePackedDensityPressure();
+
+        for (const auto& pair : pairList) {
+            const int i = pair.i;
+            const int j = pair.j;
+            if (pair.r <= 0.0001f) continue;
+
+            if (pair.hMinusR > 0.f) {
+                const float h = pair.hMinusR + pair.r;
+                const float densityI = pairDensity(i);
+                const float densityJ = pairDensity(j);
+
+                // Pressure force, antisymmetric in the pair
+                float pressure_scale = (pairPressure(i) + pairPressure(j)) / (2.f * densityI * densityJ);
+                sf::Vector2f pressure_force = pair.diff * (PARTICLE_MASS * pressure_scale *
+                    gradientKernel(pair.r, h) * pair.invR);
+                particles.addForce(i, pressure_force);
+                particles.addForce(j, -pressure_force);
+
+                // Viscosity force, each side is divided by the other particle's density
+                float viscosity_scale = PARTICLE_MASS * VISCOSITY * viscosityKernel(pair.r, h);
+                sf::Vector2f dv = particles.velocity(j) - particles.velocity(i);
+                particles.addForce(i, dv * (viscosity_scale / densityJ));
+                particles.addForce(j, -dv * (viscosity_scale / densityI));
+            }
+
+            // Check for overlap (distance between particles < 2 * radius)
+            if (pair.r < 2 * PARTICLE_RADIUS) {
+                resolveCollision(i, j, pair.diff, pair.r);
+            }
+        }
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            applyFluidForce(i, particles.force(i));
+        }
+    }
+
+    void integrate(float dt) {
+        if (HasVectorIntegrate<Store>::value) {
+            IntegrateParams params;
+            params.dt = dt;
+            params.maxVelocity = MAX_VELOCITY;
+            params.radius = PARTICLE_RADIUS;
+            params.damping = DAMPING;
+            params.left = bounds.left;
+            params.right = bounds.left + bounds.width;
+            params.top = bounds.top;
+            params.bottom = bounds.top + bounds.height;
+            integrateVector(particles, simd, params);
+            return;
+        }
+
+        for (size_t i = 0; i < particles.size(); i++) {
+            // Update velocity with force
+            const float density = particles.density(i);
+            sf::Vector2f velocity = particles.velocity(i) + dt * particles.force(i) / density;
+
+            // Clamp velocity magnitude
+            float speed = std::sqrt(velocity.x * velocity.x + velocity.y * velocity.y);
+            if (speed > MAX_VELOCITY) {
+                velocity *= MAX_VELOCITY / speed;
+            }
+
+            // Update position
+            sf::Vector2f position = particles.position(i) + dt * velocity;
+
+            // Border collision with particle radius
+            if (position.x + PARTICLE_RADIUS < bounds.left) {
+                position.x = bounds.left - PARTICLE_RADIUS;
+                velocity.x *= -DAMPING;
+            }
+            if (position.x + PARTICLE_RADIUS > bounds.left + bounds.width) {
+                position.x = bounds.left + bounds.width - PARTICLE_RADIUS;
+                velocity.x *= -DAMPING;
+            }
+            if (position.y + PARTICLE_RADIUS < bounds.top) {
+                position.y = bounds.top - PARTICLE_RADIUS;
+                velocity.y *= -DAMPING;
+            }
+            if (position.y + PARTICLE_RADIUS > bounds.top + bounds.height) {
+                position.y = bounds.top + bounds.height - PARTICLE_RADIUS;
+                velocity.y *= -DAMPING;
+            }
+
+            particles.setVelocity(i, velocity);
+            particles.setPosition(i, position);
+        }
+    }
+};
+
+typedef BasicFluidSimulator<ParticleStore, SimulationKernels> FluidSimulator;
+
+// Fills area with a lattice of particles added in random order, so that storage order
+// carries no spatial locality - the state a few seconds of mixing leave behind
+template <typename Simulator>
+void spawnShuffledLattice(Simulator& simulator, const sf::FloatRect& area, int count, float spacing) {
+    const int perRow = std::max(1, static_cast<int>(area.width / spacing));
+    std::vector<sf::Vector2f> positions;
+    for (int k = 0; k < count; k++) {
+        positions.push_back(sf::Vector2f(
+            area.left + (k % perRow) * spacing - 1 + (rand() % 3),
+            area.top + (k / perRow) * spacing - 1 + (rand() % 3)
+        ));
+    }
+    for (size_t k = positions.size(); k > 1; k--) {
+        std::swap(positions[k - 1], positions[rand() % k]);
+    }
+    for (const auto& pos : positions) {
+        simulator.addParticle(pos);
+    }
+}
+
+// The benchmarks' common scene: count particles on a shuffled 12 px lattice filling a square
+// in the middle of benchSceneBounds(count), the same particles on every call
+const float BENCH_SPACING = 12.f;
+
+inline float benchSceneSide(int count) {
+    return std::ceil(std::sqrt(static_cast<float>(count))) * BENCH_SPACING;
+}
+
+inline sf::FloatRect benchSceneBounds(int count) {
+    const float side = benchSceneSide(count);
+    return sf::FloatRect(0.f, 0.f, side * 1.5f, side * 1.5f);
+}
+
+// simulator must have been constructed with benchSceneBounds(count)
+template <typename Simulator>
+void makeBenchScene(Simulator& simulator, int count) {
+    const float side = benchSceneSide(count);
+    srand(1);
+    spawnShuffledLattice(simulator, sf::FloatRect(side * 0.25f, side * 0.25f, side, side), count, BENCH_SPACING);
+}
+
+// Headless run comparing a neighbor search against brute force on a settling block
+bool runCrossCheck(NeighborSearch search, PairEvaluation evaluation, const char* name, bool compressLists = false) {
+    const sf::FloatRect bounds(24.f, 24.f, 752.f, 552.f);
+    FluidSimulator simulator(bounds);
+    simulator.neighborSearch = search;
+    simulator.pairEvaluation = evaluation;
+    simulator.compressNeighborLists = compressLists;
+    simulator.crossCheck = true;
+
+    const int GRID_SIZE = 35;
+    const float SPACING = 12.f;
+    for (int row = 0; row < GRID_SIZE; row++) {
+        for (int col = 0; col < GRID_SIZE; col++) {
+            simulator.addParticle(sf::Vector2f(
+                bounds.left + bounds.width * 0.25f + col * SPACING - 1 + (rand() % 3),
+                bounds.top + bounds.height * 0.25f + row * SPACING - 1 + (rand() % 3)
+            ));
+        }
+    }
+
+    float worstError = 0.f;
+    float worstVectorError = 0.f;
+    float worstForceError = 0.f;
+    int missedPairs = 0;
+    for (int step = 0; step < 300; step++) {
+        simulator.update(1.f / 60.f);
+        worstError = std::max(worstError, simulator.getCrossCheckDensityError());
+        worstVectorError = std::max(worstVectorError, simulator.getCrossCheckVectorDensityError());
+        worstForceError = std::max(worstForceError, simulator.getCrossCheckVectorForceError());
+        missedPairs += simulator.getCrossCheckMissedPairs();
+    }
+
+    // Spatial queries against a scan over all particles
+    int queryMismatches = 0;
+    std::vector<int> found(simulator.getParticleCount());
+    for (int q = 0; q < 50; q++) {
+        const sf::Vector2f center(bounds.left + rand() % 752, bounds.top + rand() % 552);
+        const float radius = 5.f + rand() % 60;
+        const sf::FloatRect rect(center.x - radius, center.y - 0.5f * radius, 2.f * radius, radius);
+        const size_t k = 1 + rand() % 20;
+
+        size_t inRadius = 0, inRect = 0;
+        for (size_t j = 0; j < simulator.getParticleCount(); j++) {
+            sf::Vector2f diff = simulator.getParticlePosition(j) - center;
+            inRadius += dot(diff, diff) <= radius * radius;
+            const sf::Vector2f& pos = simulator.getParticlePosition(j);
+            inRect += pos.x >= rect.left && pos.x <= rect.left + rect.width &&
+                      pos.y >= rect.top && pos.y <= rect.top + rect.height;
+        }
+        queryMismatches += simulator.queryRadius(center, radius, found.data(), found.size()) != inRadius;
+        queryMismatches += simulator.queryRect(rect, found.data(), found.size()) != inRect;
+
+        // The k-th nearest must be no farther than any particle left out
+        size_t nearest = simulator.queryKNearest(center, k, found.data());
+        sf::Vector2f kth = simulator.getParticlePosition(found[nearest - 1]) - center;
+        size_t closer = 0;
+        for (size_t j = 0; j < simulator.getParticleCount(); j++) {
+            sf::Vector2f diff = simulator.getParticlePosition(j) - center;
+            closer += dot(diff, diff) < dot(kth, kth);
+        }
+        queryMismatches += nearest != k || closer >= k;
+    }
+
+    std::cout << name << ": " << simulator.getParticleCount() << " particles"
+              << ", max relative density error " << worstError
+              << ", missed neighbor pairs " << missedPairs
+              << ", wrong query results " << queryMismatches;
+    if (evaluation == PairEvaluation::GATHER) {
+        std::cout << ", vector density error " << worstVectorError << ", vector force error " << worstForceError;
+    }
+    if (search == NeighborSearch::VERLET_LIST) {
+        std::cout << ", rebuild rate " << simulator.getVerletRebuildRate() << ", lists "
+                  << simulator.getVerletLists().getMemoryBytes() / 1024 << " KiB";
+    }
+    if (search == NeighborSearch::INCREMENTAL_GRID) {
+        std::cout << ", full rebuild rate " << simulator.getGridFullBuildRate();
+    }
+    if (search == NeighborSearch::SPATIAL_HASH) {
+        std::cout << ", " << simulator.getSpatialHash().getOccupiedCells() << " occupied cells in "
+                  << simulator.getSpatialHash().getMemoryBytes() / 1024 << " KiB";
+    }
+    std::cout << "\n";
+    // The vector passes only round differently. Forces get more room: for r close to the support
+    // h - r cancels, and a particle with few neighbors has nothing to average that out.
+    return worstError < 1e-4f && worstVectorError < 1e-5f && worstForceError < 1e-4f &&
+           missedPairs == 0 && queryMismatches == 0;
+}
+
+// neighborSearch switched between steps: queries keep using the structure the last step built,
+// and the next step prepares the new backend before it searches
+bool runBackendSwitchCheck() {
+    const NeighborSearch searches[] = {
+        NeighborSearch::UNIFORM_GRID, NeighborSearch::QUADTREE, NeighborSearch::VERLET_LIST,
+        NeighborSearch::INCREMENTAL_GRID, NeighborSearch::SPATIAL_HASH, NeighborSearch::BRUTE_FORCE
+    };
+    const sf::FloatRect bounds(24.f, 24.f, 752.f, 552.f);
+    FluidSimulator simulator(bounds);
+    simulator.crossCheck = true;
+    simulator.spawnBlock(sf::Vector2f(212.f, 162.f), 35, 35, 12.f, 1.f, 5);
+
+    int missedPairs = 0, queryMismatches = 0;
+    std::vector<int> found(simulator.getParticleCount());
+    for (int step = 0; step < 60; step++) {
+        simulator.neighborSearch = searches[step % 6];
+        for (int q = 0; q < 10; q++) {
+            const sf::Vector2f center(bounds.left + rand() % 752, bounds.top + rand() % 552);
+            const float radius = 5.f + rand() % 60;
+            size_t inRadius = 0;
+            for (size_t j = 0; j < simulator.getParticleCount(); j++) {
+                sf::Vector2f diff = simulator.getParticlePosition(j) - center;
+                inRadius += dot(diff, diff) <= radius * radius;
+            }
+            queryMismatches += simulator.queryRadius(center, radius, found.data(), found.size()) != inRadius;
+        }
+        simulator.update(1.f / 60.f);
+        missedPairs += simulator.getCrossCheckMissedPairs();
+    }
+
+    std::cout << "backend switches: " << missedPairs << " missed neighbor pairs, "
+              << queryMismatches << " wrong query results\n";
+    return missedPairs == 0 && queryMismatches == 0;
+}
+
+// The scalar and vector GATHER force passes on a block packed closer than the contact distance:
+// both resolve the same contacts after the fluid forces, so positions only differ by rounding.
+// Only the first steps compare, later a rounding difference can move a pair across the contact
+// distance and the two runs part.
+bool runGatherForceCheck() {
+    const sf::FloatRect bounds(24.f, 24.f, 752.f, 552.f);
+    FluidSimulator scalar(bounds), vector(bounds);
+    scalar.vectorizedForces = false;
+    scalar.spawnBlock(sf::Vector2f(300.f, 200.f), 20, 20, 8.f, 1.f, 9);
+    vector.spawnBlock(sf::Vector2f(300.f, 200.f), 20, 20, 8.f, 1.f, 9);
+
+    float worstDistance = 0.f;
+    for (int step = 0; step < 2; step++) {
+        scalar.update(1.f / 60.f);
+        vector.update(1.f / 60.f);
+        for (size_t k = 0; k < scalar.getParticleCount(); k++) {
+            const sf::Vector2f diff = scalar.getParticlePosition(k) - vector.getParticlePosition(k);
+            worstDistance = std::max(worstDistance, std::sqrt(dot(diff, diff)));
+        }
+    }
+    std::cout << "gather forces, scalar against vector: max position difference " << worstDistance << " px\n";
+    return worstDistance < 1e-3f;
+}
+
+// Both RadixSorter paths give the same order as a stable sort, duplicates included, on
+// random keys, which sort() radix sorts, and on nearly sorted ones, which it hands to std::sort
+bool runSortCheck() {
+    WorkerPool pool(4);
+    RadixSorter sorter;
+    std::vector<unsigned int> keys;
+    std::vector<int> expected, sorted, radixSorted;
+    int mismatches = 0, radixPicks = 0;
+    for (int count : {1000, 40000, 100000}) {
+        keys.resize(count);
+        for (auto& key : keys) {
+            key = static_cast<unsigned int>(rand() % (count / 4)) << 8;
+        }
+        for (bool nearlySorted : {false, true}) {
+            if (nearlySorted) {
+                std::sort(keys.begin(), keys.end());
+                for (int k = 0; k < count / 20; k++) {
+                    const int i = rand() % (count - 8);
+                    std::swap(keys[i], keys[i + 1 + rand() % 7]);
+                }
+            }
+            expected.resize(count);
+            for (int k = 0; k < count; k++) expected[k] = k;
+            std::stable_sort(expected.begin(), expected.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+
+            radixPicks += RadixSorter::pays(keys);
+            sorter.sort(keys, sorted, pool);
+            sorter.radixSort(keys, radixSorted, pool);
+            mismatches += (sorted != expected) + (radixSorted != expected);
+        }
+    }
+
+    std::cout << "key sort: " << mismatches << " key sets ordered differently from a stable sort, radix path taken for "
+              << radixPicks << " of 6\n";
+    return mismatches == 0 && radixPicks == 3;
+}
+
+// Quadtree queries with random per-particle radii against brute force, in both query modes,
+// with and without a lower bound on the radii
+bool runQuadtreeCheck() {
+    const int COUNT = 3000;
+    ParticleStore particles;
+    particles.resize(COUNT);
+    std::vector<float> radii(COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        particles.setPosition(i, sf::Vector2f(static_cast<float>(rand() % 800), static_cast<float>(rand() % 600)));
+        radii[i] = 5.f + static_cast<float>(rand() % 26);
+    }
+
+    Quadtree quadtree;
+    int mismatches = 0;
+    for (float minRadius : {0.f, 15.f}) {
+        quadtree.build(particles, radii, 15.f, sharedWorkerPool(), minRadius);
+        for (Quadtree::QueryMode mode : {Quadtree::GATHER, Quadtree::SYMMETRIC}) {
+            for (int i = 0; i < COUNT; i++) {
+                int found = 0;
+                quadtree.forEachNeighbor(particles, particles.position(i), quadtree.getRadius(i), mode,
+                                         [&](int) { found++; });
+
+                int expected = 0;
+                const float ri = std::max(radii[i], minRadius);
+                for (int j = 0; j < COUNT; j++) {
+                    sf::Vector2f diff = particles.position(i) - particles.position(j);
+                    float r = mode == Quadtree::SYMMETRIC ? std::max(ri, std::max(radii[j], minRadius)) : ri;
+                    expected += dot(diff, diff) < r * r;
+                }
+                mismatches += found != expected;
+            }
+        }
+    }
+
+    std::cout << "quadtree, variable radii: " << COUNT << " particles, "
+              << mismatches << " particles with a different neighbor count\n";
+    return mismatches == 0;
+}
+
+// queryKNearest ends on particles it can never count: a NaN position is within no radius, so
+// asking for every particle returns the finite ones, the farthest of them outside bounds, and a
+// NaN center finds nothing
+bool runNearestQueryCheck() {
+    FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 400.f, 400.f));
+    for (int k = 0; k < 100; k++) {
+        simulator.addParticle(sf::Vector2f(100.f + (k % 10) * 20.f, 100.f + (k / 10) * 20.f));
+    }
+    simulator.update(0.f);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const sf::Vector2f outside(5000.f, 5000.f);
+    simulator.addParticle(sf::Vector2f(nan, nan));
+    simulator.addParticle(outside);
+
+    // The fixed point positions of CompactParticleStore store NaN as 0, which is found
+    size_t finite = 0;
+    for (size_t i = 0; i < simulator.getParticleCount(); i++) {
+        const sf::Vector2f position = simulator.getParticlePosition(i);
+        finite += std::isfinite(position.x) && std::isfinite(position.y);
+    }
+
+    std::vector<int> found(simulator.getParticleCount());
+    int mismatches = 0;
+    const size_t nearest = simulator.queryKNearest(sf::Vector2f(200.f, 200.f), found.size(), found.data());
+    mismatches += nearest != finite;
+    mismatches += nearest == 0 || simulator.getParticlePosition(found[nearest - 1]) != outside;
+    mismatches += simulator.queryKNearest(sf::Vector2f(nan, 200.f), 5, found.data()) != 0;
+
+    std::cout << "nearest queries: " << mismatches << " wrong results with a NaN particle or center\n";
+    return mismatches == 0;
+}
+
+// Smoothing lengths from half to twice the default on a jittered lattice, so many pairs are
+// covered by one support only. Densities are compared against a sum over all pairs within the
+// mean support, the velocities after one step of every backend and pair evaluation against
+// brute force gathering. Without gravity and collisions the velocities are the fluid forces alone.
+bool runVariableSmoothingCheck() {
+    const int SIDE = 30;
+    const int COUNT = SIDE * SIDE;
+    const float SPACING = 8.f;
+    srand(9);
+    std::vector<sf::Vector2f> positions(COUNT);
+    std::vector<float> lengths(COUNT);
+    for (int k = 0; k < COUNT; k++) {
+        positions[k] = sf::Vector2f(150.f + (k % SIDE) * SPACING + static_cast<float>(rand() % 5 - 2),
+                                    150.f + (k / SIDE) * SPACING + static_cast<float>(rand() % 5 - 2));
+        lengths[k] = KERNEL_SUPPORT * (0.5f + 1.5f * static_cast<float>(rand() % 1000) / 1000.f);
+    }
+
+    const float mass = FluidSimulator(sf::FloatRect()).PARTICLE_MASS;
+    std::vector<float> reference(COUNT, 0.f);
+    int oneSided = 0;
+    for (int i = 0; i < COUNT; i++) {
+        for (int j = 0; j < COUNT; j++) {
+            const sf::Vector2f diff = positions[i] - positions[j];
+            const float r2 = dot(diff, diff);
+            const float h = 0.5f * (lengths[i] + lengths[j]);
+            if (r2 >= h * h) continue;
+            const float s = KERNEL_SUPPORT / h;
+            reference[i] += mass * s * s * SimulationKernels::Density::value(r2 * s * s);
+            oneSided += r2 >= std::min(lengths[i], lengths[j]) * std::min(lengths[i], lengths[j]);
+        }
+    }
+
+    const NeighborSearch searches[] = {
+        NeighborSearch::BRUTE_FORCE, NeighborSearch::UNIFORM_GRID, NeighborSearch::VERLET_LIST,
+        NeighborSearch::SPATIAL_HASH, NeighborSearch::INCREMENTAL_GRID, NeighborSearch::QUADTREE
+    };
+    std::vector<sf::Vector2f> referenceVelocities;
+    float worstDensity = 0.f, worstVelocity = 0.f;
+    int missedPairs = 0;
+    for (NeighborSearch search : searches) {
+        for (PairEvaluation evaluation : {PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE, PairEvaluation::PAIR_LIST}) {
+            FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 600.f, 600.f), sf::Vector2f(0.f, 0.f));
+            simulator.neighborSearch = search;
+            simulator.pairEvaluation = evaluation;
+            simulator.REORDER_INTERVAL = 0;
+            simulator.PARTICLE_RADIUS = 1.5f;
+            simulator.crossCheck = true;
+            for (int k = 0; k < COUNT; k++) {
+                simulator.addParticle(positions[k]);
+                simulator.setSmoothingLength(k, lengths[k]);
+            }
+            simulator.update(1.f / 600.f);
+            missedPairs += simulator.getCrossCheckMissedPairs();
+
+            if (referenceVelocities.empty()) {
+                for (int k = 0; k < COUNT; k++) referenceVelocities.push_back(simulator.getParticleVelocity(k));
+            }
+            float fastest = 0.f;
+            for (const sf::Vector2f& v : referenceVelocities) fastest = std::max(fastest, std::sqrt(dot(v, v)));
+            for (int k = 0; k < COUNT; k++) {
+                worstDensity = std::max(worstDensity, std::abs(simulator.getParticleDensity(k) - reference[k]) / reference[k]);
+                const sf::Vector2f difference = simulator.getParticleVelocity(k) - referenceVelocities[k];
+                worstVelocity = std::max(worstVelocity, std::sqrt(dot(difference, difference)) / fastest);
+            }
+        }
+    }
+
+#if PARTICLE_LAYOUT == 3
+    // Densities and velocities are stored as halves
+    const float TOLERANCE = 2e-3f;
+#else
+    const float TOLERANCE = 1e-4f;
+#endif
+    std::cout << "variable smoothing lengths: " << COUNT << " particles, " << oneSided
+              << " pairs within one support only, max relative density error " << worstDensity
+              << ", velocity error " << worstVelocity << ", missed pairs " << missedPairs << "\n";
+    return oneSided > 0 && worstDensity < TOLERANCE && worstVelocity < 10.f * TOLERANCE && missedPairs == 0;
+}
+
+// Particle IDs keep finding the same particle through Morton reorderings. The particles are
+// too far apart to interact, and dt = 0 keeps them in place.
+bool runParticleIdCheck() {
+    const int COUNT = 2000;
+    srand(3);
+    FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 1200.f, 1200.f));
+    simulator.REORDER_INTERVAL = 1;
+
+    std::vector<sf::Vector2f> spawned;
+    std::vector<ParticleId> ids;
+    spawnShuffledLattice(simulator, sf::FloatRect(100.f, 100.f, 1000.f, 1000.f), COUNT, 20.f);
+    for (size_t slot = 0; slot < simulator.getParticleCount(); slot++) {
+        ids.push_back(simulator.getParticleId(slot));
+        spawned.push_back(simulator.getParticlePosition(slot));
+    }
+
+    int mismatches = 0;
+    for (int step = 0; step < 3; step++) {
+        simulator.update(0.f);
+        for (size_t k = 0; k < ids.size(); k++) {
+            int slot = simulator.findParticle(ids[k]);
+            mismatches += slot < 0 || simulator.getParticlePosition(slot) != spawned[k] ||
+                          simulator.getParticleId(slot) != ids[k];
+        }
+    }
+
+    // Adding a particle prepares the next step twice, the particles are sorted only once in it
+    const long reorders = simulator.getReorderCount();
+    simulator.addParticle(sf::Vector2f(50.f, 50.f));
+    simulator.update(0.f);
+    const long extraReorders = simulator.getReorderCount() - reorders - 1;
+
+    std::cout << "particle ids: " << COUNT << " particles, " << mismatches
+              << " lookups finding a different particle after reordering, " << extraReorders
+              << " repeated reorderings in a step\n";
+    return mismatches == 0 && extraReorders == 0;
+}
+
+// Random single and batch removals and re-additions in a fixed pool, each live ID has to keep
+// finding its particle, and none of them after a reset. As above the particles stay in place.
+bool runParticlePoolCheck() {
+    const int CAPACITY = 2000;
+    srand(4);
+    FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 1200.f, 1200.f));
+    simulator.REORDER_INTERVAL = 1;
+    simulator.setParticleCapacity(CAPACITY);
+
+    // Free lattice sites, and the site of every live ID
+    std::vector<sf::Vector2f> freeSites;
+    for (int k = 0; k < CAPACITY + 500; k++) {
+        freeSites.push_back(sf::Vector2f(100.f + (k % 50) * 20.f, 100.f + (k / 50) * 20.f));
+    }
+    std::vector<sf::Vector2f> liveSites;
+    std::vector<ParticleId> live;
+    int mismatches = 0;
+
+    auto add = [&]() {
+        size_t site = rand() % freeSites.size();
+        ParticleId id = simulator.addParticle(freeSites[site]);
+        if (id == INVALID_PARTICLE_ID) {
+            mismatches += live.size() != CAPACITY;
+            return;
+        }
+        liveSites.push_back(freeSites[site]);
+        freeSites[site] = freeSites.back();
+        freeSites.pop_back();
+        live.push_back(id);
+    };
+    auto forget = [&](size_t k) {
+        freeSites.push_back(liveSites[k]);
+        live[k] = live.back();
+        live.pop_back();
+        liveSites[k] = liveSites.back();
+        liveSites.pop_back();
+    };
+    std::vector<ParticleId> removed;
+
+    for (int round = 0; round < 20; round++) {
+        // Ten more than fit, the pool has to refuse them
+        for (size_t k = live.size(); k < CAPACITY + 10u; k++) add();
+
+        for (int k = 0; k < 100; k++) {
+            size_t victim = rand() % live.size();
+            mismatches += !simulator.removeParticle(live[victim]);
+            removed.push_back(live[victim]);
+            forget(victim);
+        }
+        std::vector<ParticleId> batch;
+        for (int k = 0; k < 300; k++) {
+            size_t victim = rand() % live.size();
+            batch.push_back(live[victim]);
+            removed.push_back(live[victim]);
+            forget(victim);
+        }
+        simulator.removeParticles(batch.data(), batch.size());
+        simulator.update(0.f);
+
+        mismatches += simulator.getParticleCount() != live.size();
+        for (size_t k = 0; k < live.size(); k++) {
+            int slot = simulator.findParticle(live[k]);
+            mismatches += slot < 0 || simulator.getParticlePosition(slot) != liveSites[k];
+        }
+        // The next round refills the pool from the removed particles' ID entries, their old IDs
+        // must not find the new particles
+        for (ParticleId id : removed) mismatches += simulator.findParticle(id) >= 0;
+    }
+
+    // A particle added right after a removal reuses its ID entry but not its ID
+    const ParticleId stale = live.back();
+    simulator.removeParticle(stale);
+    const ParticleId reused = simulator.addParticle(liveSites.back());
+    mismatches += reused == stale || simulator.findParticle(stale) >= 0 ||
+                  (reused & PARTICLE_ID_INDEX_MASK) != (stale & PARTICLE_ID_INDEX_MASK);
+
+    // A reset retires every ID handed out so far
+    simulator.removeAllParticles();
+    for (ParticleId id : live) mismatches += simulator.findParticle(id) >= 0;
+    mismatches += simulator.findParticle(reused) >= 0;
+    const ParticleId fresh = simulator.addParticle(freeSites[0]);
+    mismatches += fresh == reused || simulator.findParticle(fresh) != 0;
+
+    std::cout << "particle pool: capacity " << CAPACITY << ", " << mismatches
+              << " lookups or counts that do not match after removals\n";
+    return mismatches == 0;
+}
+
+// Bulk spawning: a seed reproduces a block exactly, regions hold exactly the requested count
+// inside the area, and a fixed pool truncates a spawn instead of growing
+bool runSpawnCheck() {
+    const sf::FloatRect bounds(0.f, 0.f, 800.f, 600.f);
+    FluidSimulator first(bounds), second(bounds), region(bounds), pool(bounds);
+    int mismatches = 0;
+
+    mismatches += first.spawnBlock(sf::Vector2f(100.f, 100.f), 40, 30, 6.f, 2.f, 7) != 1200;
+    second.spawnBlock(sf::Vector2f(100.f, 100.f), 40, 30, 6.f, 2.f, 7);
+    for (size_t i = 0; i < first.getParticleCount(); i++) {
+        mismatches += first.getParticlePosition(i) != second.getParticlePosition(i);
+    }
+
+    const sf::FloatRect area(50.f, 80.f, 300.f, 200.f);
+    mismatches += region.spawnRegion(area, 1001, 0.f, 7) != 1001;
+    for (size_t i = 0; i < region.getParticleCount(); i++) {
+        mismatches += !area.contains(region.getParticlePosition(i));
+    }
+
+    pool.setParticleCapacity(500);
+    mismatches += pool.spawnBlock(sf::Vector2f(100.f, 100.f), 40, 30, 6.f, 2.f, 7) != 500;
+    mismatches += pool.getParticleCount() != 500 || pool.findParticle(pool.getParticleId(499)) != 499;
+
+    // A block larger than the container moves into a container grown to fit it, as the Start
+    // button does, and stays inside through a step on the grid of the grown area
+    FluidSimulator grown(bounds);
+    const sf::FloatRect scene(0.f, 0.f, 800.f * 4.f, 600.f * 4.f);
+    grown.setBounds(scene);
+    mismatches += grown.getBounds() != scene;
+    mismatches += grown.spawnBlock(sf::Vector2f(scene.width * 0.25f, scene.height * 0.25f), 150, 150, 12.f, 1.f, 7) != 22500;
+    grown.update(1.f / 60.f);
+    for (size_t i = 0; i < grown.getParticleCount(); i++) {
+        mismatches += !scene.contains(grown.getParticlePosition(i));
+    }
+
+    std::cout << "spawning: " << mismatches << " particles or counts that differ\n";
+    return mismatches == 0;
+}
+
+// Kernel coefficients: the 2D integral of a density kernel equals the density gain, and its
+// gradient, rescaled by the gains, matches a central difference of its value
+template <typename Kernel>
+int checkKernel(const char* name) {
+    const int STEPS = 20000;
+    const float dr = KERNEL_SUPPORT / STEPS;
+    double integral = 0.0;
+    float worstGradient = 0.f;
+    for (int k = 0; k < STEPS; k++) {
+        const float r = (k + 0.5f) * dr;
+        integral += 2.0 * KERNEL_PI * r * Kernel::value(r * r) * dr;
+        if (k > 0 && k < STEPS - 1) {
+            const float h = 1e-3f;
+            const float difference = (Kernel::value((r + h) * (r + h)) - Kernel::value((r - h) * (r - h))) / (2.f * h);
+            const float scale = DENSITY_KERNEL_GAIN / GRADIENT_KERNEL_GAIN;
+            worstGradient = std::max(worstGradient, std::abs(Kernel::gradient(r) * scale - difference));
+        }
+    }
+    const float integralError = static_cast<float>(std::abs(integral / DENSITY_KERNEL_GAIN - 1.0));
+    const float gradientError = worstGradient / (Kernel::value(0.f) / KERNEL_SUPPORT);
+    std::cout << "  " << name << ": integral error " << integralError << ", gradient error " << gradientError << "\n";
+    return (integralError > 1e-3f) + (gradientError > 1e-2f);
+}
+
+bool runKernelCheck() {
+    std::cout << "kernels, relative to the density gain:\n";
+    int failures = checkKernel<CubicSplineKernel>("cubic spline") + checkKernel<WendlandC2Kernel>("Wendland C2");
+
+    // Poly6 integrates to the density gain by definition of the gain
+    double integral = 0.0;
+    const int STEPS = 20000;
+    const float dr = KERNEL_SUPPORT / STEPS;
+    for (int k = 0; k < STEPS; k++) {
+        const float r = (k + 0.5f) * dr;
+        integral += 2.0 * KERNEL_PI * r * Poly6Kernel::value(r * r) * dr;
+    }
+    failures += std::abs(integral / DENSITY_KERNEL_GAIN - 1.0) > 1e-3;
+    failures += SpikyGradientKernel::gradient(0.f) >= 0.f || ViscosityLaplacianKernel::laplacian(KERNEL_SUPPORT) != 0.f;
+    return failures == 0;
+}
+
+// A table at KERNEL_SUPPORT against the closed forms, relative to each kernel's largest value,
+// and the integral of a table rescaled to another support
+template <typename Kernels>
+int checkKernelTable(const char* name) {
+    KernelTable table;
+    table.build<Kernels>(KERNEL_SUPPORT);
+    float peakValue = 0.f, peakGradient = 0.f, peakLaplacian = 0.f;
+    float valueError = 0.f, gradientError = 0.f, laplacianError = 0.f;
+    const int STEPS = 20000;
+    for (int k = 0; k < STEPS; k++) {
+        const float r = (k + 0.5f) * (KERNEL_SUPPORT / STEPS);
+        peakValue = std::max(peakValue, std::abs(Kernels::Density::value(r * r)));
+        peakGradient = std::max(peakGradient, std::abs(Kernels::Gradient::gradient(r)));
+        peakLaplacian = std::max(peakLaplacian, std::abs(Kernels::Viscosity::laplacian(r)));
+        valueError = std::max(valueError, std::abs(table.value(r * r) - Kernels::Density::value(r * r)));
+        gradientError = std::max(gradientError, std::abs(table.gradient(r) - Kernels::Gradient::gradient(r)));
+        laplacianError = std::max(laplacianError, std::abs(table.laplacian(r) - Kernels::Viscosity::laplacian(r)));
+    }
+    valueError /= peakValue;
+    gradientError /= peakGradient;
+    laplacianError /= peakLaplacian;
+
+    const float h = 2.f * KERNEL_SUPPORT;
+    table.build<Kernels>(h);
+    double integral = 0.0;
+    for (int k = 0; k < STEPS; k++) {
+        const float r = (k + 0.5f) * (h / STEPS);
+        integral += 2.0 * KERNEL_PI * r * table.value(r * r) * (h / STEPS);
+    }
+    const float integralError = static_cast<float>(std::abs(integral / DENSITY_KERNEL_GAIN - 1.0));
+
+    std::cout << "  " << name << ": value error " << valueError << ", gradient error " << gradientError
+              << ", laplacian error " << laplacianError << ", integral error at h = " << h << " " << integralError << "\n";
+    return (valueError > 5e-4f) + (gradientError > 5e-4f) + (laplacianError > 5e-4f) + (integralError > 1e-4f);
+}
+
+// Kernel tables against the closed forms, alone and over a simulation step, and a table rebuilt
+// for a new SMOOTHING_LENGTH against one built for it from the start. The lattice spacing
+// keeps particles apart, so no collision moves them between the steps.
+bool runKernelTableCheck() {
+    std::cout << "kernel tables, relative to each kernel's peak:\n";
+    int failures = checkKernelTable<MullerKernels>("Poly6 / Spiky / viscosity") +
+                   checkKernelTable<CubicSplineKernels>("cubic spline") + checkKernelTable<WendlandKernels>("Wendland C2");
+
+    FluidSimulator closedForm(sf::FloatRect(0.f, 0.f, 800.f, 600.f));
+    FluidSimulator tabulated(sf::FloatRect(0.f, 0.f, 800.f, 600.f));
+    FluidSimulator wide(sf::FloatRect(0.f, 0.f, 800.f, 600.f));
+    tabulated.kernelEvaluation = KernelEvaluation::TABLE;
+    wide.SMOOTHING_LENGTH = 20.f;
+    for (FluidSimulator* simulator : {&closedForm, &tabulated, &wide}) {
+        simulator->spawnBlock(sf::Vector2f(100.f, 100.f), 40, 30, 11.f, 1.f, 1);
+        simulator->update(0.f);
+    }
+    float worstDensity = 0.f;
+    for (size_t i = 0; i < closedForm.getParticleCount(); i++) {
+        const float reference = closedForm.getParticleDensity(i);
+        worstDensity = std::max(worstDensity, std::abs(tabulated.getParticleDensity(i) - reference) / reference);
+    }
+
+    // The Morton order follows the grid cell size, so particles are matched by ID and the sums
+    // may differ in order
+    tabulated.SMOOTHING_LENGTH = 20.f;
+    tabulated.update(0.f);
+    float worstRebuild = 0.f;
+    for (size_t i = 0; i < wide.getParticleCount(); i++) {
+        const float reference = wide.getParticleDensity(i);
+        const int slot = tabulated.findParticle(wide.getParticleId(i));
+        worstRebuild = std::max(worstRebuild, std::abs(tabulated.getParticleDensity(slot) - reference) / reference);
+    }
+    std::cout << "  simulation step: max relative density difference " << worstDensity
+              << ", after a rebuild for h = 20 " << worstRebuild << "\n";
+#if PARTICLE_LAYOUT == 3
+    const float DENSITY_TOLERANCE = 1e-2f; // half densities
+#else
+    const float DENSITY_TOLERANCE = 1e-4f;
+#endif
+    failures += (worstDensity > DENSITY_TOLERANCE) + (worstRebuild > DENSITY_TOLERANCE / 10.f);
+    return failures == 0;
+}
+
+// Every instruction set this CPU runs against the scalar kernels on random neighborhoods and
+// particles, including self pairs, padding, clamped speeds, border hits and a partial last vector
+bool runSimdDispatchCheck() {
+    const SimdKernels scalar = simdKernelsFor(SimdPath::SCALAR);
+    const int CANDIDATES = 112; // a multiple of every width
+    AlignedFloats xs(CANDIDATES), ys(CANDIDATES), vxs(CANDIDATES), vys(CANDIDATES);
+    AlignedFloats pressures(CANDIDATES), densities(CANDIDATES);
+    AlignedInts contacts(CANDIDATES), scalarContacts(CANDIDATES);
+
+    const size_t COUNT = 1003;
+    AlignedFloats start[4] = {AlignedFloats(COUNT), AlignedFloats(COUNT), AlignedFloats(COUNT), AlignedFloats(COUNT)};
+    AlignedFloats fx(COUNT), fy(COUNT), density(COUNT);
+    SpawnRandom random(7, 0);
+    for (size_t k = 0; k < COUNT; k++) {
+        start[0][k] = 400.f + 420.f * random.nextSigned();
+        start[1][k] = 300.f + 320.f * random.nextSigned();
+        start[2][k] = 800.f * random.nextSigned();
+        start[3][k] = 800.f * random.nextSigned();
+        fx[k] = 2e6f * random.nextSigned();
+        fy[k] = 2e6f * random.nextSigned();
+        density[k] = 1000.f + 900.f * random.nextSigned();
+    }
+    IntegrateParams params = {1.f / 60.f, 500.f, 3.f, 0.5f, 0.f, 800.f, 0.f, 600.f};
+
+    bool ok = true;
+    for (SimdPath path : {SimdPath::SSE, SimdPath::AVX2, SimdPath::AVX512}) {
+        if (!simdPathSupported(path)) continue;
+        const SimdKernels kernels = simdKernelsFor(path);
+        float worstDensity = 0.f, worstForce = 0.f, worstIntegrate = 0.f;
+        int contactMismatches = 0;
+
+        for (int trial = 0; trial < 500; trial++) {
+            Particle p;
+            p.position = sf::Vector2f(100.f * random.nextSigned(), 100.f * random.nextSigned());
+            p.velocity = sf::Vector2f(300.f * random.nextSigned(), 300.f * random.nextSigned());
+            p.pressure = 1e5f * random.nextSigned();
+            p.density = 1000.f + 500.f * random.nextSigned();
+            const size_t count = (static_cast<size_t>(trial) % (CANDIDATES / 16) + 1) * 16;
+            for (size_t k = 0; k < count; k++) {
+                xs[k] = p.position.x + 20.f * random.nextSigned();
+                ys[k] = p.position.y + 20.f * random.nextSigned();
+                vxs[k] = 300.f * random.nextSigned();
+                vys[k] = 300.f * random.nextSigned();
+                pressures[k] = 1e5f * random.nextSigned();
+                densities[k] = 1000.f + 500.f * random.nextSigned();
+            }
+            xs[0] = p.position.x; // the particle itself
+            ys[0] = p.position.y;
+
+            const float density = scalar.poly6Sum(p.position.x, p.position.y, xs.data(), ys.data(), count);
+            const float vectorDensity = kernels.poly6Sum(p.position.x, p.position.y, xs.data(), ys.data(), count);
+            worstDensity = std::max(worstDensity, std::abs(vectorDensity - density) / density);
+
+            ForceCandidates c = {xs.data(), ys.data(), vxs.data(), vys.data(), pressures.data(), densities.data(),
+                                 count, 36.f, scalarContacts.data(), 0};
+            const sf::Vector2f force = scalar.spikyViscosityForce(p, c, 5.f, 0.1f);
+            // Relative to the largest single neighbor term, as terms of both signs cancel
+            float largestTerm = 0.f;
+            for (size_t k = 0; k < count; k++) {
+                ForceCandidates one = c;
+                one.x += k; one.y += k; one.vx += k; one.vy += k; one.pressure += k; one.density += k;
+                one.count = 1;
+                one.contacts = contacts.data();
+                const sf::Vector2f term = scalar.spikyViscosityForce(p, one, 5.f, 0.1f);
+                largestTerm = std::max(largestTerm, std::max(std::abs(term.x), std::abs(term.y)));
+            }
+            const size_t scalarContactCount = c.contactCount;
+            c.contacts = contacts.data();
+            const sf::Vector2f vectorForce = kernels.spikyViscosityForce(p, c, 5.f, 0.1f);
+            worstForce = std::max(worstForce, std::max(std::abs(vectorForce.x - force.x), std::abs(vectorForce.y - force.y)) /
+                                              std::max(largestTerm, 1e-20f));
+            contactMismatches += c.contactCount != scalarContactCount ||
+                                 !std::equal(contacts.begin(), contacts.begin() + scalarContactCount, scalarContacts.begin());
+        }
+
+        AlignedFloats expected[4], actual[4];
+        for (int a = 0; a < 4; a++) {
+            expected[a] = start[a];
+            actual[a] = start[a];
+        }
+        ParticleArrays arrays = {expected[0].data(), expected[1].data(), expected[2].data(), expected[3].data(),
+                                 fx.data(), fy.data(), density.data(), COUNT};
+        scalar.integrate(arrays, params);
+        arrays.x = actual[0].data();
+        arrays.y = actual[1].data();
+        arrays.vx = actual[2].data();
+        arrays.vy = actual[3].data();
+        kernels.integrate(arrays, params);
+        for (int a = 0; a < 4; a++) {
+            for (size_t k = 0; k < COUNT; k++) {
+                worstIntegrate = std::max(worstIntegrate, std::abs(actual[a][k] - expected[a][k]) / (std::abs(expected[a][k]) + 1.f));
+            }
+        }
+
+        // Half conversions round the same way, every half and the floats above, scaled into and
+        // beyond the half range
+        std::vector<std::uint16_t> halves(65536), halvesBack(65536), expectedHalves(COUNT), actualHalves(COUNT);
+        std::vector<float> values(65536), expectedValues(65536), scaled(COUNT);
+        for (size_t k = 0; k < halves.size(); k++) halves[k] = static_cast<std::uint16_t>(k);
+        for (size_t k = 0; k < COUNT; k++) scaled[k] = start[2][k] * std::ldexp(1.f, static_cast<int>(k % 40) - 20);
+        scalar.halvesToFloats(halves.data(), expectedValues.data(), halves.size());
+        kernels.halvesToFloats(halves.data(), values.data(), halves.size());
+        scalar.floatsToHalves(scaled.data(), expectedHalves.data(), COUNT);
+        kernels.floatsToHalves(scaled.data(), actualHalves.data(), COUNT);
+        kernels.floatsToHalves(expectedValues.data(), halvesBack.data(), halves.size());
+        int conversionMismatches = 0;
+        for (size_t k = 0; k < halves.size(); k++) {
+            const bool nan = (k & 0x7C00u) == 0x7C00u && (k & 0x3FFu) != 0;
+            conversionMismatches += !nan && (std::memcmp(&values[k], &expectedValues[k], sizeof(float)) != 0 ||
+                                             halvesBack[k] != halves[k]);
+        }
+        conversionMismatches += expectedHalves != actualHalves;
+
+        const bool pathOk = worstDensity < 1e-5f && worstForce < 1e-4f && worstIntegrate < 1e-5f && contactMismatches == 0 &&
+                            conversionMismatches == 0;
+        std::cout << "simd " << kernels.name << " against scalar: density error " << worstDensity
+                  << ", force error " << worstForce << ", integrate error " << worstIntegrate
+                  << ", contact mismatches " << contactMismatches << ", half conversion mismatches "
+                  << conversionMismatches << "\n";
+        ok &= pathOk;
+    }
+    return ok;
+}
+
+// Half and fixed point conversions of CompactParticleStore against their error bounds: every
+// half survives a round trip, normal floats stay within 2^-11 relative error, positions within
+// half a fixed point step, and out of range values saturate
+bool runMixedPrecisionCheck() {
+    int failures = 0;
+
+    for (std::uint32_t bits = 0; bits <= 0xFFFFu; bits++) {
+        const std::uint16_t half = static_cast<std::uint16_t>(bits);
+        const float value = halfToFloat(half);
+        if (value == value) {
+            failures += floatToHalf(value) != half;
+        } else {
+            failures += halfToFloat(floatToHalf(value)) == halfToFloat(floatToHalf(value));
+        }
+    }
+    for (float value = 1.f / 16384.f; value < 65504.f; value *= 1.0137f) {
+        const float error = std::abs(halfToFloat(floatToHalf(value)) - value) / value;
+        failures += error > 1.f / 2048.f;
+        failures += halfToFloat(floatToHalf(-value)) != -halfToFloat(floatToHalf(value));
+    }
+    failures += floatToHalf(65519.f) != 0x7BFFu || floatToHalf(65520.f) != 0x7C00u;
+    // Ties round to even, for normals and subnormals
+    failures += floatToHalf(1.f + 1.f / 2048.f) != 0x3C00u || floatToHalf(1.f + 3.f / 2048.f) != 0x3C02u;
+    failures += floatToHalf(1.5f / 16777216.f) != 0x0002u || floatToHalf(2.5f / 16777216.f) != 0x0002u;
+    failures += floatToHalf(1e-8f) != 0 || floatToHalf(-1e30f) != 0xFC00u;
+    failures += halfToPressure(pressureToHalf(2e6f)) != halfToFloat(floatToHalf(2e6f / PRESSURE_HALF_SCALE)) * PRESSURE_HALF_SCALE;
+
+    SpawnRandom random(3, 0);
+    for (int i = 0; i < 100000; i++) {
+        const float value = random.nextSigned() * 4096.f;
+        failures += std::abs(fixedToFloat(floatToFixed(value)) - value) > 0.5f / FIXED_POSITION_SCALE;
+    }
+    failures += floatToFixed(1e10f) != INT32_MAX || floatToFixed(-1e10f) != INT32_MIN;
+    failures += floatToFixed(std::nanf("")) != 0;
+
+    CompactParticleStore store;
+    Particle p;
+    p.position = sf::Vector2f(123.456f, 78.9f);
+    p.velocity = sf::Vector2f(-250.3f, 0.001f);
+    p.density = 21000.f;
+    p.pressure = 2e6f;
+    store.push_back(p);
+    store.movePosition(0, sf::Vector2f(0.01f, -0.01f));
+    const Particle q = store.get(0);
+    failures += std::abs(q.position.x - 123.466f) > 1.f / FIXED_POSITION_SCALE;
+    failures += std::abs(q.velocity.x + 250.3f) > 250.3f / 2048.f;
+    failures += std::abs(q.density - 21000.f) > 21000.f / 2048.f || std::abs(q.pressure - 2e6f) > 2e6f / 2048.f;
+
+    std::cout << "mixed precision: " << failures << " conversions outside their error bound\n";
+    return failures == 0;
+}
+
+// Compressed Verlet lists against plain ones on shuffled particles, where many neighbors
+// lie beyond a 16-bit offset and take the escape path
+bool runCompressedListCheck() {
+    const int COUNT = 60000;
+    const sf::FloatRect bounds(0.f, 0.f, 3000.f, 3000.f);
+    srand(5);
+    ParticleStore particles;
+    particles.resize(COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        particles.setPosition(i, sf::Vector2f(static_cast<float>(rand() % 3000), static_cast<float>(rand() % 3000)));
+    }
+
+    UniformGrid grid;
+    grid.build(particles, bounds, 19.f);
+    VerletLists plain, compressed;
+    plain.build(particles, grid, 15.f, 4.f);
+    compressed.build(particles, grid, 15.f, 4.f, true);
+
+    int mismatches = 0;
+    std::vector<int> expected, found;
+    for (int i = 0; i < COUNT; i++) {
+        expected.clear();
+        found.clear();
+        plain.forEachNeighbor(i, [&](int j) { expected.push_back(j); });
+        compressed.forEachNeighbor(i, [&](int j) { found.push_back(j); });
+        mismatches += expected != found;
+    }
+    long plainPairs = 0, compressedPairs = 0;
+    plain.forEachPair([&](int i, int j) { plainPairs += i + j; });
+    compressed.forEachPair([&](int i, int j) { compressedPairs += i + j; });
+    mismatches += plainPairs != compressedPairs;
+
+    std::cout << "compressed verlet lists: " << COUNT << " particles, " << compressed.getEscapeCount()
+              << " escaped neighbors, " << plain.getMemoryBytes() / 1024 << " KiB plain, "
+              << compressed.getMemoryBytes() / 1024 << " KiB compressed, " << mismatches << " lists that differ\n";
+    return mismatches == 0 && compressed.getEscapeCount() > 0;
+}
+
+// Warmed up frames of every neighbor search and pair evaluation must not touch the heap.
+// A frame is the window's: FPS counter, simulation step and drawing into a texture, or the
+// vertex fill alone where there is no GL context. Needs a build with -DTRACK_ALLOCATIONS, such
+// as the AllocCheck target; other builds have nothing to count and skip it without failing.
+bool runAllocationCheck() {
+    if (getAllocationCount() < 0) {
+        std::cout << "allocations: skipped, not tracked; build the AllocCheck target or with -DTRACK_ALLOCATIONS\n";
+        return true;
+    }
+
+    // SFML aborts on Linux when it cannot open a display for the GL context
+    bool rendering = true;
+#ifdef __linux__
+    rendering = std::getenv("DISPLAY") != nullptr;
+#endif
+    sf::RenderTexture texture;
+    rendering = rendering && texture.create(800, 600);
+    sf::Font font;
+    const bool hasFont = rendering && font.loadFromFile("./resources/tuffy.ttf");
+    FPSCounter fpsCounter;
+    auto frame = [&](FluidSimulator& simulator) {
+        fpsCounter.update();
+        simulator.update(1.f / 60.f);
+        if (rendering) {
+            texture.clear();
+            simulator.draw(texture);
+            if (hasFont) fpsCounter.draw(texture, font);
+            texture.display();
+        } else {
+            simulator.buildVertices();
+        }
+    };
+
+    const NeighborSearch searches[] = {
+        NeighborSearch::BRUTE_FORCE, NeighborSearch::UNIFORM_GRID, NeighborSearch::VERLET_LIST,
+        NeighborSearch::SPATIAL_HASH, NeighborSearch::INCREMENTAL_GRID, NeighborSearch::QUADTREE
+    };
+    const PairEvaluation evaluations[] = {
+        PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE, PairEvaluation::PAIR_LIST
+    };
+    const sf::FloatRect bounds(24.f, 24.f, 752.f, 552.f);
+
+    long long allocations = 0;
+    int allocatingRuns = 0;
+    for (NeighborSearch search : searches) {
+        for (PairEvaluation evaluation : evaluations) {
+            FluidSimulator simulator(bounds);
+            simulator.neighborSearch = search;
+            simulator.pairEvaluation = evaluation;
+            simulator.spawnBlock(sf::Vector2f(212.f, 162.f), 35, 35, 12.f, 1.f, 11);
+            for (int step = 0; step < 200; step++) {
+                frame(simulator);
+            }
+
+            const long long before = getAllocationCount();
+            for (int step = 0; step < 200; step++) {
+                frame(simulator);
+            }
+            const long long after = getAllocationCount();
+            allocations += after - before;
+            allocatingRuns += after != before;
+        }
+    }
 
-class Button {
-private:
-    sf::RectangleShape shape;
-    sf::Text text;
-    sf::Font font;
-    bool enabled = true;
-    std::function<void()> callback;
-public:
-    Button(float x, float y, float width, float height, const std::string& label, const sf::Font& font) {
-        shape.setPosition(x, y);
-        shape.setSize(sf::Vector2f(width, height));
-        shape.setFillColor(sf::Color::Blue);
-        shape.setOutlineColor(sf::Color::Black);
-        shape.setOutlineThickness(2);
+    std::cout << "allocations: " << allocations << " heap allocations in warmed up frames ("
+              << (!rendering ? "vertex fill only, no GL context" : hasFont ? "drawn to a texture" : "drawn to a texture, no font")
+              << "), " << allocatingRuns << " of 18 configurations allocating\n";
+    return allocations == 0;
+}
 
-        this->font = font;
-        text.setFont(this->font);
-        text.setString(label);
-        text.setCharacterSize(20);
-        text.setFillColor(sf::Color::White);
+int runCrossChecks() {
+    const NeighborSearch searches[] = {
+        NeighborSearch::UNIFORM_GRID, NeighborSearch::VERLET_LIST, NeighborSearch::SPATIAL_HASH,
+        NeighborSearch::INCREMENTAL_GRID, NeighborSearch::QUADTREE
+    };
+    const char* searchNames[] = {"uniform grid", "verlet lists", "spatial hash", "incremental grid", "quadtree"};
+    const PairEvaluation evaluations[] = {
+        PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE, PairEvaluation::PAIR_LIST
+    };
+    const char* evaluationNames[] = {"gather", "pair once", "pair list"};
 
-        // Center text
-        sf::FloatRect textBounds = text.getLocalBounds();
-        text.setOrigin(textBounds.left + textBounds.width / 2.0f, textBounds.top + textBounds.height / 2.0f);
-        text.setPosition(x + width / 2.0f, y + height / 2.0f);
+    bool ok = true;
+    for (int s = 0; s < 5; s++) {
+        for (int e = 0; e < 3; e++) {
+            std::string name = std::string(searchNames[s]) + ", " + evaluationNames[e];
+            ok &= runCrossCheck(searches[s], evaluations[e], name.c_str());
+        }
+    }
+    for (int e = 0; e < 3; e++) {
+        std::string name = std::string("compressed verlet lists, ") + evaluationNames[e];
+        ok &= runCrossCheck(NeighborSearch::VERLET_LIST, evaluations[e], name.c_str(), true);
     }
+    ok &= runCompressedListCheck();
+    ok &= runBackendSwitchCheck();
+    ok &= runGatherForceCheck();
+    ok &= runSortCheck();
+    ok &= runQuadtreeCheck();
+    ok &= runVariableSmoothingCheck();
+    ok &= runNearestQueryCheck();
+    ok &= runParticleIdCheck();
+    ok &= runParticlePoolCheck();
+    ok &= runSpawnCheck();
+    ok &= runMixedPrecisionCheck();
+    ok &= runKernelCheck();
+    ok &= runKernelTableCheck();
+    ok &= runSimdDispatchCheck();
+    ok &= runAllocationCheck();
+    return ok ? 0 : 1;
+}
 
-    void setCallback(const std::function<void()>& func) {
-        callback = func;
+// Hardware cache miss counter for the benchmarks, reports -1 where perf events are unavailable
+class CacheMissCounter {
+private:
+    int fd = -1;
+public:
+    CacheMissCounter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
     }
 
-    void setEnabled(bool value) {
-        enabled = value;
+    ~CacheMissCounter() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
     }
 
-    void draw(sf::RenderWindow& window) {
-        window.draw(shape);
-        window.draw(text);
+    void start() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
     }
 
-    void handleEvent(const sf::Event& event, const sf::RenderWindow& window) {
-        if (enabled && event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
-            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-            if (shape.getGlobalBounds().contains(static_cast<sf::Vector2f>(mousePos))) {
-                if (callback) callback(); // Run the given function
-            }
+    long long stop() {
+#ifdef __linux__
+        long long misses = 0;
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &misses, sizeof(misses)) == sizeof(misses)) return misses;
         }
+#endif
+        return -1;
     }
 };
 
+struct BenchmarkResult {
+    double msPerStep;
+    long long cacheMissesPerStep;
+};
 
-struct Particle {
-    sf::CircleShape shape;
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    sf::Vector2f force;
-    float density;
-    float pressure;
+template <typename Simulator>
+BenchmarkResult timeSteps(Simulator& simulator, int warmupSteps, int steps) {
+    for (int step = 0; step < warmupSteps; step++) {
+        simulator.update(1.f / 60.f);
+    }
 
-    Particle(float radius) : shape(radius), density(0.f), pressure(0.f) {
-        shape.setFillColor(sf::Color::Cyan);
+    CacheMissCounter counter;
+    counter.start();
+    auto begin = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) {
+        simulator.update(1.f / 60.f);
     }
-};
+    auto end = std::chrono::steady_clock::now();
+    long long misses = counter.stop();
 
-float dot(const sf::Vector2f& a, const sf::Vector2f& b) {
-    return a.x * b.x + a.y * b.y;
+    BenchmarkResult result;
+    result.msPerStep = std::chrono::duration<double, std::milli>(end - begin).count() / steps;
+    result.cacheMissesPerStep = misses < 0 ? -1 : misses / steps;
+    return result;
 }
 
-class FPSCounter {
-private:
-    float fps;
-    sf::Clock clock;
-    sf::Time previousTime;
+void printResult(const std::string& name, const BenchmarkResult& result) {
+    std::cout << "  " << std::left << std::setw(28) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(9) << result.msPerStep << " ms/step";
+    if (result.cacheMissesPerStep >= 0) {
+        std::cout << std::setw(12) << result.cacheMissesPerStep << " cache misses/step";
+    }
+    std::cout << "\n";
+}
 
-    static const int SAMPLE_SIZE = 10;
-    std::array<float, SAMPLE_SIZE> fpsHistory;
-    int currentSample = 0;
+// Morton reordering against spawn order on a scrambled lattice
+void benchmarkReordering(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    std::cout << "Morton reordering, " << count << " particles\n";
 
-public:
-    FPSCounter() : fps(0.0f), currentSample(0) {
-        previousTime = clock.getElapsedTime();
-        fpsHistory.fill(0.0f);
+    for (int interval : {0, 50}) {
+        FluidSimulator simulator(bounds);
+        simulator.REORDER_INTERVAL = interval;
+        makeBenchScene(simulator, count);
+        printResult(interval == 0 ? "spawn order" : "reorder every 50 steps", timeSteps(simulator, 2, 10));
     }
+}
 
-    void update() {
-        sf::Time currentTime = clock.getElapsedTime();
-        sf::Time deltaTime = currentTime - previousTime;
-        previousTime = currentTime;
+// Verlet lists against a grid rebuilt every step on a settled pool, the case the lists are
+// meant for: a 120x50 dam break left to come to rest, then stepped on. Reports how often the
+// lists are rebuilt, the search, density and force time per step, and how far particles move
+// in a step, which decides whether lists built with a skin survive it.
+void benchmarkSettledPool() {
+    std::cout << "Settled pool, 120x50 dam break after 900 steps, 300 steps measured\n";
+    struct Setup {
+        const char* name;
+        NeighborSearch search;
+        float skin;
+        int reorderInterval;
+        float radius;
+    };
+    const Setup setups[] = {
+        {"uniform grid", NeighborSearch::UNIFORM_GRID, 4.f, 50, 5.f},
+        {"verlet, skin 4", NeighborSearch::VERLET_LIST, 4.f, 50, 5.f},
+        {"verlet, skin 4, no reorder", NeighborSearch::VERLET_LIST, 4.f, 0, 5.f},
+        {"verlet, skin 8, no reorder", NeighborSearch::VERLET_LIST, 8.f, 0, 5.f},
+        {"verlet, skin 8, radius 1.5", NeighborSearch::VERLET_LIST, 8.f, 0, 1.5f},
+    };
+    for (const Setup& setup : setups) {
+        FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 1600.f, 800.f));
+        simulator.neighborSearch = setup.search;
+        simulator.VERLET_SKIN = setup.skin;
+        simulator.REORDER_INTERVAL = setup.reorderInterval;
+        simulator.PARTICLE_RADIUS = setup.radius;
+        simulator.spawnBlock(sf::Vector2f(12.f, 188.f), 120, 50, 6.f, 1.f, 1);
+        for (int step = 0; step < 900; step++) {
+            simulator.update(1.f / 60.f);
+        }
 
-        // Calculate instantaneous fps
-        float currentFps = 1.0f / deltaTime.asSeconds();
+        std::vector<sf::Vector2f> before(simulator.getParticleCount());
+        std::vector<ParticleId> ids(before.size());
+        for (size_t i = 0; i < before.size(); i++) {
+            ids[i] = simulator.getParticleId(i);
+            before[i] = simulator.getParticlePosition(i);
+        }
+        simulator.resetPassTimes();
+        double meanMove = 0.0;
+        float maxMove = 0.f;
+        for (int step = 0; step < 300; step++) {
+            simulator.update(1.f / 60.f);
+            if (step == 0) {
+                for (size_t i = 0; i < before.size(); i++) {
+                    const sf::Vector2f moved = simulator.getParticlePosition(simulator.findParticle(ids[i])) - before[i];
+                    const float distance = std::sqrt(dot(moved, moved));
+                    meanMove += distance / before.size();
+                    maxMove = std::max(maxMove, distance);
+                }
+            }
+        }
+        std::cout << "  " << std::left << std::setw(28) << setup.name << std::right << std::fixed << std::setprecision(2)
+                  << "rebuild rate " << std::setw(4) << simulator.getTimedVerletRebuildRate() << ", "
+                  << "search " << std::setw(5) << simulator.getSearchPassMs() << " ms, "
+                  << "density " << std::setw(5) << simulator.getDensityPassMs() << " ms, "
+                  << "forces " << std::setw(5) << simulator.getForcePassMs() << " ms, "
+                  << "step moves mean " << std::setw(5) << meanMove << " px, max " << std::setw(5) << maxMove << " px\n";
+    }
+}
 
-        // Store in circular buffer
-        fpsHistory[currentSample] = currentFps;
-        currentSample = (currentSample + 1) % SAMPLE_SIZE;
+// Gathering every neighbor from both sides against evaluating each pair once,
+// directly or from the cached pair list
+void benchmarkPairEvaluation(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    std::cout << "Pair evaluation, " << count << " particles\n";
 
-        // Calculate average fps
-        float sum = 0.0f;
-        for (float sample : fpsHistory) {
-            sum += sample;
+    const PairEvaluation evaluations[] = {
+        PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE, PairEvaluation::PAIR_LIST
+    };
+    const char* names[] = {"gather both sides", "pair once", "pair list"};
+    for (int e = 0; e < 3; e++) {
+        FluidSimulator simulator(bounds);
+        simulator.pairEvaluation = evaluations[e];
+        makeBenchScene(simulator, count);
+        printResult(names[e], timeSteps(simulator, 2, 10));
+
+        if (evaluations[e] == PairEvaluation::PAIR_LIST) {
+            std::cout << "    " << simulator.getPairCount() << " pairs, " << sizeof(NeighborPair)
+                      << " bytes per pair, " << simulator.getPairListBytes() / 1024 << " KiB\n";
         }
-        fps = sum / SAMPLE_SIZE;
     }
+}
 
-    std::string getFPSString() const {
-        std::stringstream ss;
-        ss << std::fixed << std::setprecision(1) << fps << " FPS";
-        return ss.str();
-    }
+// Density and force passes of one particle layout, in ms/step
+template <typename Store>
+void benchmarkLayout(const char* name, PairEvaluation evaluation, int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
 
-    void draw(sf::RenderWindow& window, const sf::Font& font,
-             unsigned int characterSize = 20,
-             sf::Vector2f position = sf::Vector2f(27, 25)) {
-        sf::Text text;
-        text.setFont(font);
-        text.setString(getFPSString());
-        text.setCharacterSize(characterSize);
-        text.setFillColor(sf::Color::White);
-        text.setPosition(position);
-        window.draw(text);
+    BasicFluidSimulator<Store> simulator(bounds);
+    simulator.pairEvaluation = evaluation;
+    makeBenchScene(simulator, count);
+    for (int step = 0; step < 2; step++) {
+        simulator.update(1.f / 60.f);
+    }
+    simulator.resetPassTimes();
+    for (int step = 0; step < 10; step++) {
+        simulator.update(1.f / 60.f);
     }
-};
-
-class FluidSimulator {
-private:
-    sf::Vector2f gravity;
-    sf::FloatRect bounds;
-    std::vector<Particle> particles;
 
-    const float VISCOSITY = 7000.f;
-    const float REST_DENSITY = 1000.f;
-    const float GAS_CONSTANT = 100.f;
-    const float SMOOTHING_LENGTH = 15.f;
-    const float SMOOTHING_LENGTH_SQ = SMOOTHING_LENGTH * SMOOTHING_LENGTH;
-    const float POLY6_SCALE = 315.f / (64.f * 3.14 * std::pow(SMOOTHING_LENGTH, 4));
-    const float SPIKY_GRAD_SCALE = -45.f / (3.14 * std::pow(SMOOTHING_LENGTH, 6));
-    const float VISC_LAP_SCALE = 45.f / (3.14 * std::pow(SMOOTHING_LENGTH, 6));
-public:
-    float PARTICLE_RADIUS = 5.f;
-    float DAMPING = 0.4f;
-    float MAX_VELOCITY = 300.f;
-    float PARTICLE_MASS = 5.0f;
+    std::cout << "    " << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+              << "density " << std::setw(7) << simulator.getDensityPassMs() << " ms, "
+              << "forces " << std::setw(7) << simulator.getForcePassMs() << " ms\n";
+}
 
-    FluidSimulator(const sf::FloatRect& boundsRect, const sf::Vector2f& gravityVec = sf::Vector2f(0.f, 981.f))
-        : gravity(gravityVec), bounds(boundsRect) {}
+// Density and force passes of one kernel set, in ms/step
+template <typename Kernels>
+void benchmarkKernelSet(const char* name, int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
 
-    void addParticle(const sf::Vector2f& pos) {
-        Particle p(PARTICLE_RADIUS);
-        p.position = pos;
-        p.velocity = sf::Vector2f(0.f, 0.f);
-        p.force = sf::Vector2f(0.f, 0.f);
-        p.shape.setPosition(pos);
-        particles.push_back(p);
+    BasicFluidSimulator<ParticleStore, Kernels> simulator(bounds);
+    makeBenchScene(simulator, count);
+    for (int step = 0; step < 2; step++) {
+        simulator.update(1.f / 60.f);
+    }
+    simulator.resetPassTimes();
+    for (int step = 0; step < 10; step++) {
+        simulator.update(1.f / 60.f);
     }
 
-    void removeAllParticles() {
+    std::cout << "  " << std::left << std::setw(26) << name << std::right << std::fixed << std::setprecision(2)
+              << "density " << std::setw(7) << simulator.getDensityPassMs() << " ms, "
+              << "forces " << std::setw(7) << simulator.getForcePassMs() << " ms\n";
+}
 
-        particles.clear();
-    }
+void benchmarkKernels(int count) {
+    std::cout << "SPH kernels, " << count << " particles\n";
+    benchmarkKernelSet<MullerKernels>("Poly6 / Spiky / viscosity", count);
+    benchmarkKernelSet<CubicSplineKernels>("cubic spline", count);
+    benchmarkKernelSet<WendlandKernels>("Wendland C2", count);
+}
 
-    void update(float dt) {
-        computeDensityPressure();
-        computeForces();
-        integrate(dt);
+// Closed-form kernels against table lookups: ns per evaluation over random radii in the support,
+// then the GATHER passes of a simulation step. Both use the plain loops, as the SIMD passes only
+// implement the closed forms. The evaluations take turns, the best of several rounds is reported.
+template <typename Kernels>
+void benchmarkKernelTableSet(const char* name, int count) {
+    const int SAMPLES = 1 << 16;
+    const int REPEATS = 20;
+    const int ROUNDS = 4;
+    AlignedFloats radii(SAMPLES);
+    SpawnRandom random(11, 0);
+    for (float& r : radii) {
+        r = 0.4995f * KERNEL_SUPPORT * (random.nextSigned() + 1.f);
     }
+    KernelTable table;
+    table.build<Kernels>(KERNEL_SUPPORT);
 
-    void shake() {
-        for (auto& p : particles) {
-                switch(rand() % 4) {
-                case 0:
-                    p.velocity += sf::Vector2f(0.f, static_cast<float>(rand() % 10000));
-                    break;
-                case 1:
-                    p.velocity += sf::Vector2f(static_cast<float>(rand() % 10000), 0.f);
-                    break;
-                case 2:
-                    p.velocity += sf::Vector2f(0.f, -static_cast<float>(rand() % 10000));
-                    break;
-                case 3:
-                    p.velocity += sf::Vector2f(-static_cast<float>(rand() % 10000), 0.f);
-                    break;
+    volatile float sink = 0.f;
+    auto nsPerEvaluation = [&](auto kernel) {
+        auto begin = std::chrono::steady_clock::now();
+        float sum = 0.f;
+        for (int repeat = 0; repeat < REPEATS; repeat++) {
+            for (float r : radii) {
+                sum += kernel(r);
             }
         }
+        sink = sum;
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+               (static_cast<double>(REPEATS) * SAMPLES);
+    };
+
+    BasicFluidSimulator<ParticleStore, Kernels> simulator(benchSceneBounds(count));
+    simulator.vectorizedDensity = false;
+    simulator.vectorizedForces = false;
+    makeBenchScene(simulator, count);
+    for (int step = 0; step < 2; step++) {
+        simulator.update(1.f / 60.f);
     }
 
-    void wind(int direction, float force) {
-        // 0123 - up right down left
-        switch(direction) {
-            case 0:
-                for (auto& p : particles) {
-                    p.velocity += sf::Vector2f(0.f, -force);
-                }
-                break;
-            case 1:
-                for (auto& p : particles) {
-                    p.velocity += sf::Vector2f(force, 0.f);
-                }
-                break;
-            case 2:
-                for (auto& p : particles) {
-                    p.velocity += sf::Vector2f(0.f, force);
-                }
-                break;
-            case 3:
-                for (auto& p : particles) {
-                    p.velocity += sf::Vector2f(-force, 0.f);
-                }
-                break;
+    double valueNs[2] = {1e30, 1e30}, gradientNs[2] = {1e30, 1e30}, laplacianNs[2] = {1e30, 1e30};
+    double densityMs[2] = {1e30, 1e30}, forceMs[2] = {1e30, 1e30};
+    for (int round = 0; round < ROUNDS; round++) {
+        valueNs[0] = std::min(valueNs[0], nsPerEvaluation([](float r) { return Kernels::Density::value(r * r); }));
+        valueNs[1] = std::min(valueNs[1], nsPerEvaluation([&](float r) { return table.value(r * r); }));
+        gradientNs[0] = std::min(gradientNs[0], nsPerEvaluation([](float r) { return Kernels::Gradient::gradient(r); }));
+        gradientNs[1] = std::min(gradientNs[1], nsPerEvaluation([&](float r) { return table.gradient(r); }));
+        laplacianNs[0] = std::min(laplacianNs[0], nsPerEvaluation([](float r) { return Kernels::Viscosity::laplacian(r); }));
+        laplacianNs[1] = std::min(laplacianNs[1], nsPerEvaluation([&](float r) { return table.laplacian(r); }));
+
+        for (int tabulated = 0; tabulated < 2; tabulated++) {
+            simulator.kernelEvaluation = tabulated ? KernelEvaluation::TABLE : KernelEvaluation::CLOSED_FORM;
+            simulator.resetPassTimes();
+            for (int step = 0; step < 5; step++) {
+                simulator.update(0.f);
+            }
+            densityMs[tabulated] = std::min(densityMs[tabulated], simulator.getDensityPassMs());
+            forceMs[tabulated] = std::min(forceMs[tabulated], simulator.getForcePassMs());
         }
     }
 
-    void draw(sf::RenderWindow& window) {
-        // Find max pressure in current frame for dynamic scaling
-        float max_pressure = 0.0f;
-        for (const auto& p : particles) {
-            max_pressure = std::max(max_pressure, p.pressure);
+    std::cout << "  " << name << "\n";
+    for (int tabulated = 0; tabulated < 2; tabulated++) {
+        std::cout << "    " << std::left << std::setw(14) << (tabulated ? "table" : "closed form")
+                  << std::right << std::fixed << std::setprecision(2)
+                  << "value " << std::setw(5) << valueNs[tabulated] << " ns, "
+                  << "gradient " << std::setw(5) << gradientNs[tabulated] << " ns, "
+                  << "laplacian " << std::setw(5) << laplacianNs[tabulated] << " ns, "
+                  << "density " << std::setw(7) << densityMs[tabulated] << " ms, "
+                  << "forces " << std::setw(7) << forceMs[tabulated] << " ms\n";
+    }
+}
 
-        }
+void benchmarkKernelTables(int count) {
+    KernelTable table;
+    table.build<MullerKernels>(KERNEL_SUPPORT);
+    std::cout << "Kernel tables, " << table.getMemoryBytes() / 1024 << " KiB per table, " << count << " particles\n";
+    benchmarkKernelTableSet<MullerKernels>("Poly6 / Spiky / viscosity", count);
+    benchmarkKernelTableSet<CubicSplineKernels>("cubic spline", count);
+    benchmarkKernelTableSet<WendlandKernels>("Wendland C2", count);
+}
 
-        // Avoid division by zero
-        max_pressure = std::max(max_pressure, 0.0001f);
+// Scalar against vector GATHER density and force passes and integrate, for each instruction set
+// the CPU supports, on a settled dam break. The scene is held still with dt = 0 and the paths
+// take turns, the best of several rounds is reported.
+void benchmarkVectorPasses() {
+    std::cout << "Vector passes, settled 120x50 dam break, selected kernels " << simdKernels().name << "\n";
+    const int ROUNDS = 4;
 
-        for (auto& p : particles) {
-            // Normalize pressure between 0 and 1
-            float pressure_scale = p.pressure / max_pressure;
+    // The plain passes, then every instruction set this CPU runs
+    std::vector<SimdKernels> paths(1, simdKernelsFor(SimdPath::SCALAR));
+    for (SimdPath path : {SimdPath::SCALAR, SimdPath::SSE, SimdPath::AVX2, SimdPath::AVX512}) {
+        if (simdPathSupported(path)) paths.push_back(simdKernelsFor(path));
+    }
 
-            // Create a color gradient from blue (low pressure) to red (high pressure)
-            sf::Color color(
-                static_cast<sf::Uint8>(200 * pressure_scale),                    // Red
-                static_cast<sf::Uint8>(100 * (1.0f - pressure_scale)),          // Green
-                static_cast<sf::Uint8>(255 * (1.0f - pressure_scale))           // Blue
-            );
-            if (show_coloring)
-                p.shape.setFillColor(color);
-            else
-                p.shape.setFillColor(sf::Color::Cyan);
-            p.shape.setPosition(p.position);
-            window.draw(p.shape);
+    for (NeighborSearch search : {NeighborSearch::UNIFORM_GRID, NeighborSearch::VERLET_LIST}) {
+        FluidSimulator simulator(sf::FloatRect(0.f, 0.f, 1600.f, 800.f));
+        simulator.neighborSearch = search;
+        simulator.spawnBlock(sf::Vector2f(12.f, 188.f), 120, 50, 6.f, 1.f, 1);
+        for (int step = 0; step < 300; step++) {
+            simulator.update(1.f / 60.f);
         }
-    }
-private:
-    void computeDensityPressure() {
-        for (auto& pi : particles) {
-            pi.density = 0.f;
-            for (auto& pj : particles) {
-                sf::Vector2f diff = pi.position - pj.position;
-                float r2 = diff.x * diff.x + diff.y * diff.y;
 
-                if (r2 < SMOOTHING_LENGTH_SQ) {
-                    pi.density += PARTICLE_MASS * POLY6_SCALE * std::pow(SMOOTHING_LENGTH_SQ - r2, 3.f);
+        std::vector<double> densityMs(paths.size(), 1e30), forceMs(paths.size(), 1e30), integrateMs(paths.size(), 1e30);
+        for (int round = 0; round < ROUNDS; round++) {
+            for (size_t p = 0; p < paths.size(); p++) {
+                simulator.vectorizedDensity = p != 0;
+                simulator.vectorizedForces = p != 0;
+                simulator.simd = paths[p];
+                simulator.resetPassTimes();
+                for (int step = 0; step < 20; step++) {
+                    simulator.update(0.f);
                 }
+                densityMs[p] = std::min(densityMs[p], simulator.getDensityPassMs());
+                forceMs[p] = std::min(forceMs[p], simulator.getForcePassMs());
+                integrateMs[p] = std::min(integrateMs[p], simulator.getIntegratePassMs());
             }
+        }
 
+        for (size_t p = 0; p < paths.size(); p++) {
+            std::cout << "  " << std::left << std::setw(32)
+                      << std::string(search == NeighborSearch::UNIFORM_GRID ? "uniform grid" : "verlet lists") +
+                         (p == 0 ? ", plain loops" : std::string(", ") + paths[p].name + " kernels")
+                      << std::right << std::fixed << std::setprecision(2)
+                      << "density " << std::setw(7) << densityMs[p] << " ms, "
+                      << "forces " << std::setw(7) << forceMs[p] << " ms, "
+                      << "integrate " << std::setw(6) << std::setprecision(3) << integrateMs[p] << " ms\n";
+        }
+    }
+}
+
+// Array of structures, structure of arrays and SIMD-width blocks on the same scene
+void benchmarkParticleLayouts(int count) {
+    std::cout << "Particle layout, " << count << " particles, " << SIMD_LANES << " lanes per AoSoA block\n";
+    for (PairEvaluation evaluation : {PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE}) {
+        std::cout << (evaluation == PairEvaluation::GATHER ? "  gather both sides\n" : "  pair once\n");
+        benchmarkLayout<AoSParticleStore>("array of structures", evaluation, count);
+        benchmarkLayout<SoAParticleStore>("structure of arrays", evaluation, count);
+        benchmarkLayout<AoSoAParticleStore<SIMD_LANES>>("blocks (AoSoA)", evaluation, count);
+        benchmarkLayout<CompactParticleStore>("mixed precision arrays", evaluation, count);
+    }
+}
+
+// Emitter and sink traffic on a full fixed pool: every step removes 500 particles one at a time
+// and 500 as a batch, then refills the pool. The pool operations are timed apart from the steps.
+void benchmarkParticleChurn(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    const float side = benchSceneSide(count);
+    const int STEPS = 10;
+    const int REMOVALS = 500;
+    std::cout << "Particle pool churn, " << count << " particles\n";
+
+    FluidSimulator simulator(bounds);
+    simulator.setParticleCapacity(count);
+    makeBenchScene(simulator, count);
 
-            pi.pressure = GAS_CONSTANT * (pi.density - REST_DENSITY);
+    std::vector<ParticleId> batch;
+    batch.reserve(REMOVALS);
+    double singleMs = 0.0, batchMs = 0.0, addMs = 0.0, stepMs = 0.0;
+    int added = 0;
+    for (int step = 0; step < STEPS; step++) {
+        auto t0 = std::chrono::steady_clock::now();
+        simulator.update(1.f / 60.f);
+        auto t1 = std::chrono::steady_clock::now();
+        for (int k = 0; k < REMOVALS; k++) {
+            simulator.removeParticle(simulator.getParticleId(rand() % simulator.getParticleCount()));
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        batch.clear();
+        for (int k = 0; k < REMOVALS; k++) {
+            batch.push_back(simulator.getParticleId(rand() % simulator.getParticleCount()));
         }
+        simulator.removeParticles(batch.data(), batch.size());
+        auto t3 = std::chrono::steady_clock::now();
+        while (simulator.getParticleCount() < static_cast<size_t>(count)) {
+            simulator.addParticle(sf::Vector2f(side * 0.25f + rand() % static_cast<int>(side),
+                                               side * 0.25f + rand() % static_cast<int>(side)));
+            added++;
+        }
+        auto t4 = std::chrono::steady_clock::now();
+
+        stepMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        singleMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        batchMs += std::chrono::duration<double, std::milli>(t3 - t2).count();
+        addMs += std::chrono::duration<double, std::milli>(t4 - t3).count();
     }
 
-    void computeForces() {
-        for (auto& pi : particles) {
-            sf::Vector2f pressure_force(0.f, 0.f);
-            sf::Vector2f viscosity_force(0.f, 0.f);
+    std::cout << std::fixed << std::setprecision(3)
+              << "  step                       " << std::setw(9) << stepMs / STEPS << " ms\n"
+              << "  " << REMOVALS << " single removals       " << std::setw(9) << singleMs / STEPS << " ms\n"
+              << "  batch removal of " << REMOVALS << "      " << std::setw(9) << batchMs / STEPS << " ms\n"
+              << "  " << added / STEPS << " additions            " << std::setw(9) << addMs / STEPS << " ms\n";
+}
 
-            for (auto& pj : particles) {
-                if (&pi == &pj) continue;
+// Verlet lists with 32-bit indices against 16-bit offsets decoded in the kernels
+void benchmarkCompressedLists(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    std::cout << "Verlet list storage, " << count << " particles\n";
 
-                sf::Vector2f diff = pi.position - pj.position;
-                float r = std::sqrt(diff.x * diff.x + diff.y * diff.y);
+    for (bool compress : {false, true}) {
+        FluidSimulator simulator(bounds);
+        simulator.neighborSearch = NeighborSearch::VERLET_LIST;
+        simulator.compressNeighborLists = compress;
+        makeBenchScene(simulator, count);
+        printResult(compress ? "16-bit offsets" : "32-bit indices", timeSteps(simulator, 2, 10));
+        std::cout << "    " << simulator.getVerletLists().getMemoryBytes() / 1024 << " KiB, "
+                  << simulator.getVerletLists().getEscapeCount() << " escaped neighbors\n";
+    }
+}
 
-                if (r < SMOOTHING_LENGTH && r > 0.0001f) {
-                    // Pressure force
-                    float pressure_scale = (pi.pressure + pj.pressure) / (2.f * pi.density * pj.density);
-                    sf::Vector2f normalized_diff = diff / r;
-                    pressure_force += normalized_diff * (PARTICLE_MASS * pressure_scale *
-                        SPIKY_GRAD_SCALE * std::pow(SMOOTHING_LENGTH - r, 2.f));
+// Anonymous memory of this process backed by transparent huge pages, -1 where unknown
+long long hugePageKiB() {
+#ifdef __linux__
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) return -1;
+    char line[256];
+    long long kib = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "AnonHugePages: %lld kB", &kib) == 1) break;
+    }
+    fclose(file);
+    return kib;
+#else
+    return -1;
+#endif
+}
 
-                    // Viscosity force
-                    viscosity_force += (pj.velocity - pi.velocity) *
-                        (PARTICLE_MASS * VISCOSITY / pj.density * VISC_LAP_SCALE * (SMOOTHING_LENGTH - r));
-                }
+// Large buffers on regular pages against transparent huge pages
+void benchmarkHugePages(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    std::cout << "Huge pages, " << count << " particles\n";
 
+    for (bool hugePages : {false, true}) {
+        useHugePages = hugePages;
+        FluidSimulator simulator(bounds);
+        makeBenchScene(simulator, count);
+        BenchmarkResult result = timeSteps(simulator, 2, 5);
+        printResult(hugePages ? "2 MB huge pages" : "4 KiB pages", result);
+        std::cout << "    " << hugePageKiB() << " KiB of the process on huge pages\n";
+    }
+    useHugePages = true;
+}
 
-                // Check for overlap (distance between particles < 2 * radius)
-                if (r < 2 * PARTICLE_RADIUS) {
-                    sf::Vector2f normalized_diff = diff / r; // Collision normal
+// One addParticle() and rand() per particle against the parallel bulk spawn
+void benchmarkSpawning(int side) {
+    const float SPACING = 2.f;
+    const sf::FloatRect bounds(0.f, 0.f, side * SPACING * 1.5f, side * SPACING * 1.5f);
+    std::cout << "Spawning " << side << "x" << side << " particles, "
+              << sharedWorkerPool().getThreadCount() << " threads\n";
 
-                    // Calculate relative velocity
-                    sf::Vector2f relative_velocity = pi.velocity - pj.velocity;
+    FluidSimulator looped(bounds), bulk(bounds);
+    auto begin = std::chrono::steady_clock::now();
+    for (int row = 0; row < side; row++) {
+        for (int col = 0; col < side; col++) {
+            looped.addParticle(sf::Vector2f(col * SPACING - 1 + (rand() % 3), row * SPACING - 1 + (rand() % 3)));
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    bulk.spawnBlock(sf::Vector2f(0.f, 0.f), side, side, SPACING, 1.f, 1);
+    auto end = std::chrono::steady_clock::now();
 
-                    // Normal velocity component (along collision normal)
-                    float normal_velocity = dot(relative_velocity, normalized_diff);
+    std::cout << "  addParticle loop " << std::fixed << std::setprecision(2) << std::setw(9)
+              << std::chrono::duration<double, std::milli>(middle - begin).count() << " ms\n"
+              << "  spawnBlock       " << std::setw(9)
+              << std::chrono::duration<double, std::milli>(end - middle).count() << " ms\n";
+}
 
-                    // Only resolve if particles are moving toward each other
-                    if (normal_velocity < 0) {
-                        // Coefficient of restitution (1.0 = perfectly elastic)
-                        const float RESTITUTION = 0.8f;
+// Full counting sort every step against re-binning only the particles that changed cells
+void benchmarkRebinning(int count) {
+    const sf::FloatRect bounds = benchSceneBounds(count);
+    std::cout << "Grid re-binning, " << count << " particles\n";
 
-                        // Calculate impulse
-                        float impulse = -(1.0f + RESTITUTION) * normal_velocity;
-                        impulse /= 2.0f; // Assuming equal mass for both particles
+    for (NeighborSearch search : {NeighborSearch::UNIFORM_GRID, NeighborSearch::INCREMENTAL_GRID}) {
+        FluidSimulator simulator(bounds);
+        simulator.neighborSearch = search;
+        simulator.pairEvaluation = PairEvaluation::PAIR_LIST;
+        makeBenchScene(simulator, count);
+        if (search == NeighborSearch::UNIFORM_GRID) {
+            printResult("full rebuild", timeSteps(simulator, 2, 10));
+        } else {
+            printResult("incremental", timeSteps(simulator, 2, 10));
+            std::cout << "    " << simulator.getGridRebinnedParticles() << " particles re-binned in the last step, "
+                      << "full rebuild rate " << simulator.getGridFullBuildRate() << "\n";
+        }
+    }
+}
 
-                        // Apply impulse
-                        pi.velocity += normalized_diff * impulse;
-                        pj.velocity -= normalized_diff * impulse;
+// Parallel radix sort of 32-bit keys with permutation against std::sort of an index array,
+// per pool size. Random keys are the first reorder. Later reorders start from sorted keys where
+// one in 20 moved a few places, plus a growing share that moved anywhere.
+void benchmarkRadixSort() {
+    const int hardwareThreads = sharedWorkerPool().getThreadCount();
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < hardwareThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
 
-                        // Separate particles to prevent overlap
-                        float overlap = 2 * PARTICLE_RADIUS - r;
-                        sf::Vector2f separation = normalized_diff * (overlap * 0.5f);
-                        pi.position += separation;
-                        pj.position -= separation;
+    RadixSorter sorter;
+    std::vector<unsigned int> keys;
+    std::vector<int> order;
+    bool sorted = true;
+    // Milliseconds per std::sort and per radix sort of keys, small sorts repeated to about
+    // 2M keys so the timer resolves them
+    auto timeSorts = [&](WorkerPool& pool, double& stdMs, double& radixMs) {
+        const int count = static_cast<int>(keys.size());
+        const int repeats = std::max(1, 2000000 / count);
+        order.resize(count);
+        auto begin = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < repeats; repeat++) {
+            for (int i = 0; i < count; i++) order[i] = i;
+            std::sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < repeats; repeat++) {
+            sorter.radixSort(keys, order, pool);
+        }
+        auto end = std::chrono::steady_clock::now();
+        for (int i = 1; i < count; i++) sorted &= keys[order[i - 1]] <= keys[order[i]];
+        stdMs = std::chrono::duration<double, std::milli>(middle - begin).count() / repeats;
+        radixMs = std::chrono::duration<double, std::milli>(end - middle).count() / repeats;
+    };
 
-                        // Clear forces since we're handling collision response through velocity
-                        pi.force = sf::Vector2f(0.0f, 0.0f);
-                        pj.force = sf::Vector2f(0.0f, 0.0f);
+    for (int threads : threadCounts) {
+        WorkerPool pool(threads);
+        std::cout << "Key sort, " << threads << " threads, keys moved far | disorder | std::sort | radix\n";
+        int sets = 0, radixFaster = 0, pickedFaster = 0;
+        for (int count : {10000, 100000, 1000000, 2000000}) {
+            for (float moved : {0.f, 0.01f, 0.02f, 0.05f, 0.1f, 0.2f, 0.5f, 1.f}) {
+                srand(1);
+                keys.resize(count);
+                for (auto& key : keys) {
+                    key = (static_cast<unsigned int>(rand()) << 16) ^ static_cast<unsigned int>(rand());
+                }
+                if (moved < 1.f) {
+                    std::sort(keys.begin(), keys.end());
+                    for (int k = 0; k < count / 20; k++) {
+                        const int i = rand() % (count - 8);
+                        std::swap(keys[i], keys[i + 1 + rand() % 7]);
+                    }
+                    for (int k = 0; k < static_cast<int>(count * moved); k++) {
+                        keys[rand() % count] = (static_cast<unsigned int>(rand()) << 16) ^ static_cast<unsigned int>(rand());
                     }
                 }
+                double stdMs, radixMs;
+                timeSorts(pool, stdMs, radixMs);
+
+                const bool radixWins = radixMs < stdMs;
+                sets++;
+                radixFaster += radixWins;
+                pickedFaster += RadixSorter::pays(keys) == radixWins;
+                std::cout << "  " << std::setw(8) << count << " keys, " << std::setw(4) << moved << ": "
+                          << std::fixed << std::setprecision(3) << std::setw(6) << RadixSorter::disorder(keys)
+                          << " | " << std::setw(8) << stdMs << " ms | " << std::setw(8) << radixMs << " ms"
+                          << (radixWins ? ", radix faster" : "") << "\n";
+                std::cout.unsetf(std::ios::fixed);
             }
+        }
+        std::cout << "  radix sort is faster on " << radixFaster << " of " << sets << " key sets, "
+                  << "RadixSorter::sort picks the faster path on " << pickedFaster
+                  << (sorted ? "" : ", NOT SORTED") << "\n";
+    }
+}
 
-            // Combine all forces: pressure, viscosity, and gravity
-            pi.force = pressure_force + viscosity_force + gravity * pi.density;
+// Bottom-up quadtree rebuild time, which bounds how often adaptive runs can afford it
+void benchmarkQuadtreeBuild() {
+    std::cout << "Quadtree build, " << sharedWorkerPool().getThreadCount() << " threads\n";
+    Quadtree quadtree;
+    std::vector<float> radii;
 
-            // Limit force magnitude
-            float force_magnitude = std::sqrt(pi.force.x * pi.force.x + pi.force.y * pi.force.y);
-            if (force_magnitude > MAX_VELOCITY * pi.density) {
-                pi.force *= (MAX_VELOCITY * pi.density / force_magnitude);
-            }
+    for (int count : {10000, 100000, 1000000}) {
+        srand(1);
+        ParticleStore particles;
+        particles.resize(count);
+        for (int i = 0; i < count; i++) {
+            particles.setPosition(i, sf::Vector2f(static_cast<float>(rand() % 10000), static_cast<float>(rand() % 10000)));
         }
+
+        quadtree.build(particles, radii, 15.f, sharedWorkerPool());
+        auto begin = std::chrono::steady_clock::now();
+        quadtree.build(particles, radii, 15.f, sharedWorkerPool());
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << "  " << std::setw(8) << count << " particles: " << std::fixed << std::setprecision(2)
+                  << std::setw(8) << std::chrono::duration<double, std::milli>(end - begin).count() << " ms, "
+                  << quadtree.getNodeCount() << " nodes\n";
     }
+}
 
-    void integrate(float dt) {
+// Particle with the sf::CircleShape it used to embed, only its size matters here
+struct ParticleWithShape {
+    unsigned char shape[sizeof(sf::CircleShape)];
+    Particle particle;
+};
 
-        for (auto& p : particles) {
-            // Update velocity with force
-            p.velocity += dt * p.force / p.density;
+// The app's default 35x35 block, or a dam break filling the left of a wide box
+template <typename Store>
+void spawnMixedPrecisionScene(BasicFluidSimulator<Store>& simulator, bool damBreak) {
+    if (damBreak) {
+        simulator.spawnBlock(sf::Vector2f(12.f, 188.f), 60, 50, 12.f, 1.f, 1);
+    } else {
+        simulator.spawnBlock(sf::Vector2f(212.f, 162.f), 35, 35, 12.f, 1.f, 1);
+    }
+}
 
-            // Clamp velocity magnitude
-            float speed = std::sqrt(p.velocity.x * p.velocity.x + p.velocity.y * p.velocity.y);
-            if (speed > MAX_VELOCITY) {
-                p.velocity *= MAX_VELOCITY / speed;
-            }
+// Accuracy of the mixed precision layout against float storage on the same scenes, compared
+// particle by particle through their IDs. Both runs diverge like any chaotic flow, so the
+// deviations grow with the step count; the early steps show the storage error itself.
+void benchmarkMixedPrecision() {
+    std::cout << "Mixed precision, " << sizeof(float) * 8 << " against "
+              << 2 * sizeof(std::int32_t) + 4 * sizeof(std::uint16_t) + 2 * sizeof(float)
+              << " bytes per particle\n";
+    const char* sceneNames[] = {"settling 35x35 block", "dam break 60x50"};
+    const sf::FloatRect sceneBounds[] = {sf::FloatRect(24.f, 24.f, 752.f, 552.f), sf::FloatRect(0.f, 0.f, 1600.f, 800.f)};
 
-            // Update position
-            p.position += dt * p.velocity;
+    for (int scene = 0; scene < 2; scene++) {
+        for (PairEvaluation evaluation : {PairEvaluation::GATHER, PairEvaluation::PAIR_ONCE}) {
+            std::cout << "  " << sceneNames[scene]
+                      << (evaluation == PairEvaluation::GATHER ? ", gather both sides\n" : ", pair once\n");
+            BasicFluidSimulator<SoAParticleStore> full(sceneBounds[scene]);
+            BasicFluidSimulator<CompactParticleStore> compact(sceneBounds[scene]);
+            full.pairEvaluation = evaluation;
+            compact.pairEvaluation = evaluation;
+            spawnMixedPrecisionScene(full, scene == 1);
+            spawnMixedPrecisionScene(compact, scene == 1);
 
-            // Border collision with particle radius
-            if (p.position.x + PARTICLE_RADIUS < bounds.left) {
-                p.position.x = bounds.left - PARTICLE_RADIUS;
-                p.velocity.x *= -DAMPING;
-            }
-            if (p.position.x + PARTICLE_RADIUS > bounds.left + bounds.width) {
-                p.position.x = bounds.left + bounds.width - PARTICLE_RADIUS;
-                p.velocity.x *= -DAMPING;
-            }
-            if (p.position.y + PARTICLE_RADIUS < bounds.top) {
-                p.position.y = bounds.top - PARTICLE_RADIUS;
-                p.velocity.y *= -DAMPING;
-            }
-            if (p.position.y + PARTICLE_RADIUS > bounds.top + bounds.height) {
-                p.position.y = bounds.top + bounds.height - PARTICLE_RADIUS;
-                p.velocity.y *= -DAMPING;
+            double fullMs = 0.0, compactMs = 0.0;
+            int step = 0;
+            for (int report : {10, 100, 300}) {
+                auto begin = std::chrono::steady_clock::now();
+                for (int k = step; k < report; k++) full.update(1.f / 60.f);
+                auto middle = std::chrono::steady_clock::now();
+                for (int k = step; k < report; k++) compact.update(1.f / 60.f);
+                auto end = std::chrono::steady_clock::now();
+                fullMs += std::chrono::duration<double, std::milli>(middle - begin).count();
+                compactMs += std::chrono::duration<double, std::milli>(end - middle).count();
+                step = report;
+
+                double meanDeviation = 0.0, meanDensityError = 0.0;
+                float maxDeviation = 0.f;
+                const size_t count = full.getParticleCount();
+                for (size_t i = 0; i < count; i++) {
+                    const int j = compact.findParticle(full.getParticleId(i));
+                    const sf::Vector2f diff = full.getParticlePosition(i) - compact.getParticlePosition(j);
+                    const float deviation = std::sqrt(diff.x * diff.x + diff.y * diff.y);
+                    meanDeviation += deviation;
+                    maxDeviation = std::max(maxDeviation, deviation);
+                    meanDensityError += std::abs(full.getParticleDensity(i) - compact.getParticleDensity(j)) /
+                                        std::max(full.getParticleDensity(i), 0.0001f);
+                }
+                std::cout << "    step " << std::setw(3) << report << std::fixed << std::setprecision(4)
+                          << ": position deviation mean " << std::setw(9) << meanDeviation / count
+                          << " px, max " << std::setw(9) << maxDeviation
+                          << " px, density error mean " << std::setprecision(5) << meanDensityError / count << "\n";
             }
+            std::cout << "    " << std::setprecision(2) << fullMs / step << " ms/step float, "
+                      << compactMs / step << " ms/step mixed\n";
         }
     }
-};
+}
+
+// Memory footprint of the physics particle with and without embedded render state, and the
+// cost of streaming through each layout and through the SoAParticleStore arrays in an integrate-like pass
+void benchmarkParticleFootprint() {
+    const int COUNT = 200000;
+    const int PASSES = 50;
+    std::cout << "Particle footprint, " << COUNT << " particles\n"
+              << "  with sf::CircleShape " << std::setw(5) << sizeof(ParticleWithShape) << " bytes, "
+              << sizeof(ParticleWithShape) * COUNT / 1024 << " KiB\n"
+              << "  simulation fields    " << std::setw(5) << sizeof(Particle) << " bytes, "
+              << sizeof(Particle) * COUNT / 1024 << " KiB\n";
+
+    std::vector<ParticleWithShape> withShape(COUNT);
+    std::vector<Particle> plain(COUNT);
+    auto integratePass = [](Particle& p) {
+        p.velocity += (1.f / 60.f) * p.force;
+        p.position += (1.f / 60.f) * p.velocity;
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (auto& p : withShape) integratePass(p.particle);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (auto& p : plain) integratePass(p);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    SoAParticleStore store;
+    store.resize(COUNT);
+    auto storeBegin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < store.size(); i++) {
+            store.vx(i) += (1.f / 60.f) * store.fx(i);
+            store.vy(i) += (1.f / 60.f) * store.fy(i);
+            store.x(i) += (1.f / 60.f) * store.vx(i);
+            store.y(i) += (1.f / 60.f) * store.vy(i);
+        }
+    }
+    auto storeEnd = std::chrono::steady_clock::now();
+
+    std::cout << "  integrate pass: " << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double, std::milli>(middle - begin).count() / PASSES << " ms with shapes, "
+              << std::chrono::duration<double, std::milli>(end - middle).count() / PASSES << " ms without, "
+              << std::chrono::duration<double, std::milli>(storeEnd - storeBegin).count() / PASSES << " ms as arrays\n";
+}
+
+int runBenchmarks() {
+    benchmarkParticleFootprint();
+    benchmarkSettledPool();
+    benchmarkPairEvaluation(50000);
+    benchmarkParticleLayouts(50000);
+    benchmarkKernels(50000);
+    benchmarkKernelTables(50000);
+    benchmarkVectorPasses();
+    benchmarkMixedPrecision();
+    benchmarkParticleChurn(50000);
+    benchmarkSpawning(1000);
+    benchmarkHugePages(1000000);
+    benchmarkCompressedLists(200000);
+    benchmarkRebinning(50000);
+    benchmarkReordering(50000);
+    benchmarkReordering(100000);
+    benchmarkRadixSort();
+    benchmarkQuadtreeBuild();
+    return 0;
+}
 
-int main() {
+int main(int argc, char* argv[]) {
     // Seed rand
     srand(time(NULL));
 
+    // Kernels chosen from CPUID and FLUID_SIMD, selected before printing so override warnings come first
+    const SimdKernels& simd = simdKernels();
+    std::cout << "SIMD kernels: " << simd.name << ", " << simd.width << " lanes\n";
+
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        return runCrossChecks();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        return runBenchmarks();
+    }
+
     // SFML Window Setup
     sf::RenderWindow window(
         sf::VideoMode(800, 600),
@@ -474,6 +5929,13 @@ int main() {
     font.loadFromFile("./resources/tuffy.ttf");
     FPSCounter fps_counter;
 
+    // Instruction set of each pass, under the FPS counter, set once the simulator exists
+    sf::Text simd_text;
+    simd_text.setFont(font);
+    simd_text.setCharacterSize(20);
+    simd_text.setFillColor(sf::Color::White);
+    simd_text.setPosition(27, 50);
+
     // Border Setup
     const float BORDER_PADDING = 20.f;
     const float BORDER_THICKNESS = 4.f;
@@ -496,18 +5958,27 @@ int main() {
 
     // Define FluidSimulator
     FluidSimulator simulator(bounds);
+    std::cout << "SIMD passes: " << simulator.describeSimdPasses() << "\n";
+    simd_text.setString(simulator.describeSimdPasses());
+
+    // Start spawns a square block a quarter into the container. Blocks too large for the window
+    // scale the container up around the window origin until they fit, and scene_view shows the
+    // scaled scene in the window, so the border frames it unchanged.
+    const float BLOCK_SPACING = 12.f;
+    const int MAX_GRID_SIZE = 1000;
+    sf::View scene_view = window.getDefaultView();
 
     // Button & Slider setup
     Button button_start(300, 200, 200, 50, "Start", font);
     Button button_reset(550, 90, 220, 50, "Reset", font);
     Button button_coloring(550, 30, 220, 50, "Show Pressure ON/OFF", font);
-    Slider slider_gridsize(300, 300, 200, 1, 35, "Grid Size");
+    Slider slider_gridsize(300, 300, 200, 1, MAX_GRID_SIZE, "Grid Size");
     Slider slider_radius(300, 360, 200, 3, 10, "Particle Radius"); // default 5
     Slider slider_damping(300, 420, 200, 0, 100, "Damping%"); // default 7000
     Slider slider_max_velocity(300, 480, 200, 300, 1000, "Max Velocity"); // default 300
     Slider slider_mass(300, 540, 200, 4, 10, "Particle Mass"); // default 5
 
-    button_start.setCallback([&show_menu, &bounds, &simulator, &button_reset, &button_start, &slider_gridsize, &slider_radius, &slider_damping ,&slider_max_velocity, &slider_mass]() {
+    button_start.setCallback([&show_menu, &window, &bounds, &scene_view, BLOCK_SPACING, &simulator, &button_reset, &button_start, &slider_gridsize, &slider_radius, &slider_damping ,&slider_max_velocity, &slider_mass]() {
         show_menu = false;
         button_reset.setEnabled(true);
         button_start.setEnabled(false);
@@ -519,18 +5990,13 @@ int main() {
         simulator.DAMPING = static_cast<float>(1.f - slider_damping.getValue()/100.f); // do 7000
 
         const int GRID_SIZE = slider_gridsize.getValue();
-        const float SPACING = 12.f;
-        const float startX = bounds.left + bounds.width * 0.25f;
-        const float startY = bounds.top + bounds.height * 0.25f;
+        const float scale = std::max(1.f, GRID_SIZE * BLOCK_SPACING / (0.75f * std::min(bounds.width, bounds.height)));
+        const sf::FloatRect scene(bounds.left * scale, bounds.top * scale, bounds.width * scale, bounds.height * scale);
+        simulator.setBounds(scene);
+        scene_view.reset(sf::FloatRect(0.f, 0.f, window.getSize().x * scale, window.getSize().y * scale));
 
-        for (int row = 0; row < GRID_SIZE; row++) {
-            for (int col = 0; col < GRID_SIZE; col++) {
-                simulator.addParticle(sf::Vector2f(
-                    startX + col * SPACING - 1 + (rand() % 3),
-                    startY + row * SPACING - 1 + (rand() % 3)
-                ));
-            }
-        }
+        const sf::Vector2f block_start(scene.left + scene.width * 0.25f, scene.top + scene.height * 0.25f);
+        simulator.spawnBlock(block_start, GRID_SIZE, GRID_SIZE, BLOCK_SPACING, 1.f, rand());
     });
 
     button_reset.setCallback([&show_menu, &simulator, &button_reset, &button_start]() {
@@ -548,6 +6014,7 @@ int main() {
             show_coloring = true;
     });
 
+    long long simulatedFrames = 0;
     while (window.isOpen()) {
         sf::Event event;
         while (window.pollEvent(event)) {
@@ -595,6 +6062,8 @@ int main() {
             }
         }
 
+        // SFML queues events in a std::deque, so the count starts after polling
+        const long long allocationsBefore = getAllocationCount();
         fps_counter.update();
 
         window.clear();
@@ -609,13 +6078,25 @@ int main() {
             slider_mass.draw(window);
         } else {
             simulator.update(DELTA_TIME);
+            window.setView(scene_view);
             simulator.draw(window);
+            window.setView(window.getDefaultView());
             button_reset.draw(window);
         }
 
         window.draw(border);
         fps_counter.draw(window, font);
+        window.draw(simd_text);
         window.display();
+
+        // With TRACK_ALLOCATIONS, simulation frames that still allocate after warm-up are logged,
+        // which covers the drawing --check cannot reach without a display. Failing is left to
+        // runAllocationCheck.
+        simulatedFrames = show_menu ? 0 : simulatedFrames + 1;
+        const long long frameAllocations = getAllocationCount() - allocationsBefore;
+        if (allocationsBefore >= 0 && simulatedFrames > 120 && frameAllocations > 0) {
+            std::cerr << "frame " << simulatedFrames << ": " << frameAllocations << " heap allocations\n";
+        }
     }
 
     return 0;